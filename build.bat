@@ -3,6 +3,7 @@
 IF "%1" NEQ "" GOTO Compile
 echo Usage: %0 <name>
 echo where scene_<name>.c should be a file in .\src\
+echo Add "module" after the name to build a DLL for panim_host.exe instead
 GOTO End
 
 :Compile
@@ -11,7 +12,9 @@ cd bin
 
 SET SourceFile=..\src\scene_%1.c
 SET WarningsFlags=/W3 /WX /D_CRT_SECURE_NO_WARNINGS
-SET CompilerFlags=/nologo /Fepanim.exe /I..\include /O2 /Zi %WarningsFlags%
+SET OutputFlags=/Fepanim.exe
+IF "%2" == "module" SET OutputFlags=/LD /MD /DPANIM_MODULE /Fescene_%1.dll
+SET CompilerFlags=/nologo %OutputFlags% /I..\include /O2 /Zi %WarningsFlags%
 
 SET FFmpegLibs=avcodec.lib avformat.lib avutil.lib swscale.lib
 SET SdlLibs=x64\SDL2.lib x64\SDL2main.lib x64\SDL2_image.lib x64\SDL2_ttf.lib
@@ -0,0 +1,114 @@
+/***********************************************************
+ Pixel Kernel Benchmark
+ 
+ Measures the fill rate of each variant of the CPU
+ backend's pixel kernels on a 1280x720 frame, and checks
+ that all variants agree with the scalar reference.
+ 
+ To build:
+     cl /O2 kernel_bench.c /Febin\kernel_bench.exe /Iinclude /Isrc /link /libpath:lib\x64 SDL2.lib SDL2main.lib
+***********************************************************/
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "panim_kernels.h"
+
+#undef main
+
+#define ERROR(E) do { fprintf(stderr, "Error: " E "\n"); exit(1); } while (0)
+#define Width 1280
+#define Height 720
+#define MinSeconds 0.25
+
+typedef enum {
+    KERNEL_FILL,
+    KERNEL_COPY,
+    KERNEL_MODULATE,
+    KERNEL_BLEND,
+    KERNEL_COUNT,
+} KernelId;
+
+static const char * kernel_names[KERNEL_COUNT] = {
+    "fill", "copy", "modulate", "blend",
+};
+
+static uint32_t *src_pixels;
+static uint32_t *dst_pixels;
+
+static void run_kernel(const PAnimKernels *kernels, KernelId id) {
+    for (int y = 0; y < Height; ++y) {
+        uint32_t *dst = dst_pixels + y * Width;
+        uint32_t *src = src_pixels + y * Width;
+        switch (id) {
+            case KERNEL_FILL:     kernels->fill(dst, Width, 0xFF202020); break;
+            case KERNEL_COPY:     kernels->copy(dst, src, Width); break;
+            case KERNEL_MODULATE: kernels->modulate(dst, src, Width, 0xC0806040); break;
+            case KERNEL_BLEND:    kernels->blend(dst, src, Width); break;
+            default: break;
+        }
+    }
+}
+
+// Fills the source frame with premultiplied pixels of varying alpha, and
+// resets the destination to the same opaque pattern for every variant
+static void reset_pixels(void) {
+    srand(1);
+    for (int i = 0; i < Width * Height; ++i) {
+        uint32_t a = rand() & 0xFF;
+        src_pixels[i] = panim_premultiply(a, rand() & 0xFF, rand() & 0xFF, rand() & 0xFF);
+        dst_pixels[i] = 0xFF000000 | (uint32_t)(rand() & 0xFFFFFF);
+    }
+}
+
+int main(void) {
+    src_pixels = (uint32_t *) malloc(Width * Height * sizeof(uint32_t));
+    dst_pixels = (uint32_t *) malloc(Width * Height * sizeof(uint32_t));
+    uint32_t *reference = (uint32_t *) malloc(Width * Height * sizeof(uint32_t));
+    if (!src_pixels || !dst_pixels || !reference) ERROR("out of memory!");
+    
+    const PAnimKernels *variants[3];
+    int variant_count = 0;
+    variants[variant_count++] = &panim_kernels_scalar;
+#ifdef PNM_KERNELS_X86
+    if (SDL_HasSSE2()) variants[variant_count++] = &panim_kernels_sse2;
+    if (SDL_HasAVX2()) variants[variant_count++] = &panim_kernels_avx2;
+#endif
+    
+    printf("selected: %s\n\n", panim_kernels_select()->name);
+    printf("%-10s %-8s %12s\n", "kernel", "variant", "Mpixels/s");
+    
+    double frequency = (double)SDL_GetPerformanceFrequency();
+    int mismatches = 0;
+    for (int id = 0; id < KERNEL_COUNT; ++id) {
+        for (int v = 0; v < variant_count; ++v) {
+            // One pass for checking results, then as many as fit the time
+            reset_pixels();
+            run_kernel(variants[v], (KernelId)id);
+            if (v == 0) {
+                memcpy(reference, dst_pixels, Width * Height * sizeof(uint32_t));
+            } else if (memcmp(reference, dst_pixels, Width * Height * sizeof(uint32_t)) != 0) {
+                printf("%-10s %-8s differs from scalar!\n", kernel_names[id], variants[v]->name);
+                ++mismatches;
+            }
+            
+            Uint64 begin = SDL_GetPerformanceCounter();
+            Uint64 end = begin;
+            long long frames = 0;
+            while ((double)(end - begin) / frequency < MinSeconds) {
+                run_kernel(variants[v], (KernelId)id);
+                ++frames;
+                end = SDL_GetPerformanceCounter();
+            }
+            
+            double seconds = (double)(end - begin) / frequency;
+            double pixels = (double)frames * Width * Height;
+            printf("%-10s %-8s %12.1f\n", kernel_names[id], variants[v]->name,
+                   pixels / seconds / 1e6);
+        }
+    }
+    
+    free(reference);
+    free(dst_pixels);
+    free(src_pixels);
+    return mismatches ? 1 : 0;
+}
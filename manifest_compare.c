@@ -0,0 +1,98 @@
+/***********************************************************
+ Manifest Comparison
+
+ Compares two checksum manifests written with --manifest,
+ and reports the first frame in which they differ, either
+ in the rendered pixels or in the object state. Frames
+ only one of the manifests has are skipped.
+
+ To build:
+     cl /O2 manifest_compare.c /Febin\manifest_compare.exe
+***********************************************************/
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+
+#define ERROR(E) do { fprintf(stderr, "Error: " E "\n"); exit(1); } while (0)
+
+typedef struct {
+    size_t frame;
+    unsigned long long pixels;
+    unsigned long long state;
+} Checksum;
+
+typedef struct {
+    int width;
+    int height;
+    size_t length;
+    Checksum *frames;
+    size_t count;
+} Manifest;
+
+static void load_manifest(Manifest *manifest, const char *filename) {
+    FILE *file = fopen(filename, "r");
+    if (!file) ERROR("failed to open manifest!");
+
+    if (fscanf(file, "panim manifest %d %d %zu",
+               &manifest->width, &manifest->height, &manifest->length) != 3) {
+        ERROR("not a manifest file!");
+    }
+
+    size_t capacity = 1024;
+    manifest->frames = (Checksum *) malloc(capacity * sizeof(Checksum));
+    manifest->count = 0;
+
+    Checksum c;
+    while (fscanf(file, "%zu %llx %llx", &c.frame, &c.pixels, &c.state) == 3) {
+        if (manifest->count == capacity) {
+            capacity *= 2;
+            manifest->frames = (Checksum *) realloc(manifest->frames, capacity * sizeof(Checksum));
+        }
+        if (!manifest->frames) ERROR("out of memory!");
+        manifest->frames[manifest->count++] = c;
+    }
+
+    fclose(file);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        printf("Usage: %s <Manifest> <Manifest>\n", argv[0]);
+        return 2;
+    }
+
+    Manifest a, b;
+    load_manifest(&a, argv[1]);
+    load_manifest(&b, argv[2]);
+
+    if (a.width != b.width || a.height != b.height || a.length != b.length) {
+        printf("different scenes: %dx%d, %zu frames vs. %dx%d, %zu frames\n",
+               a.width, a.height, a.length, b.width, b.height, b.length);
+        return 1;
+    }
+
+    // Both are in ascending frame order, walk them side by side
+    size_t i = 0, j = 0, compared = 0;
+    while (i < a.count && j < b.count) {
+        Checksum *x = a.frames + i;
+        Checksum *y = b.frames + j;
+        if (x->frame < y->frame) { ++i; continue; }
+        if (x->frame > y->frame) { ++j; continue; }
+
+        if (x->pixels != y->pixels || x->state != y->state) {
+            printf("first divergent frame: %zu (%s%s%s)\n", x->frame,
+                   x->pixels != y->pixels ? "pixels" : "",
+                   x->pixels != y->pixels && x->state != y->state ? " and " : "",
+                   x->state != y->state ? "object state" : "");
+            return 1;
+        }
+
+        ++compared;
+        ++i;
+        ++j;
+    }
+
+    printf("%zu frames match (%zu and %zu frames recorded)\n", compared, a.count, b.count);
+    return 0;
+}
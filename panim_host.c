@@ -0,0 +1,184 @@
+/***********************************************************
+ Scene Host
+
+ Previews a scene built as a shared library, and rebuilds
+ the scene whenever the library changes on disk, resuming
+ playback where it was. Images and fonts stay loaded, so
+ only the scene code runs again:
+
+     panim_host bin\scene_huffmans_alg.dll
+
+ Build the scene with build.bat huffmans_alg module, or
+ with -shared -fPIC -DPANIM_MODULE elsewhere. The library
+ is loaded from a copy, so it can be rebuilt while in use.
+ On Windows, the host and all modules have to use the
+ same C runtime DLL (/MD), as they share the engine.
+
+ To build:
+     cl /O2 /MD panim_host.c /Febin\panim_host.exe /Iinclude /Isrc /D_CRT_SECURE_NO_WARNINGS /link /libpath:lib avcodec.lib avformat.lib avutil.lib swscale.lib x64\SDL2.lib x64\SDL2main.lib x64\SDL2_image.lib x64\SDL2_ttf.lib
+***********************************************************/
+
+#include "panim.h"
+#include "sys/types.h"
+#include "sys/stat.h"
+
+#ifdef _WIN32
+#define STAT_STRUCT struct _stat64
+#define STAT_FUNC _stat64
+#else
+#define STAT_STRUCT struct stat
+#define STAT_FUNC stat
+#endif
+
+typedef struct {
+    const char *path;
+    char live_path[1024]; // the copy that is actually loaded
+    void *library;
+    PAnimSceneSetupFunc *setup;
+    PAnimSceneLoadFunc *load;
+    PAnimSceneBuildFunc *build;
+    int generation;
+
+    // Of the library when it was last loaded, and when it was last polled;
+    // it is only reloaded once it stopped changing between two polls
+    long long loaded_time, loaded_size;
+    long long polled_time, polled_size;
+} Module;
+
+static bool file_info(const char *path, long long *time, long long *size) {
+    STAT_STRUCT info;
+    if (STAT_FUNC(path, &info) != 0) return false;
+    *time = (long long) info.st_mtime;
+    *size = (long long) info.st_size;
+    return true;
+}
+
+static bool copy_file(const char *from, const char *to) {
+    FILE *in = fopen(from, "rb");
+    if (!in) return false;
+    FILE *out = fopen(to, "wb");
+    if (!out) { fclose(in); return false; }
+
+    char buffer[64 * 1024];
+    size_t count;
+    bool ok = true;
+    while ((count = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        if (fwrite(buffer, 1, count, out) != count) { ok = false; break; }
+    }
+
+    fclose(in);
+    if (fclose(out) != 0) ok = false;
+    return ok;
+}
+
+// Loads the current build of the library, reporting why if it can't
+static bool load_module(Module *module) {
+    file_info(module->path, &module->loaded_time, &module->loaded_size);
+    module->polled_time = module->loaded_time;
+    module->polled_size = module->loaded_size;
+
+    // Alternating between two copies, as the previous one is still loaded
+    snprintf(module->live_path, sizeof(module->live_path), "%s.live%d",
+             module->path, module->generation % 2);
+    if (!copy_file(module->path, module->live_path)) {
+        fprintf(stderr, "Error: failed to copy %s\n", module->path);
+        return false;
+    }
+
+    module->library = SDL_LoadObject(module->live_path);
+    if (!module->library) {
+        fprintf(stderr, "Error: %s\n", SDL_GetError());
+        return false;
+    }
+
+    module->setup = (PAnimSceneSetupFunc *) SDL_LoadFunction(module->library, "panim_module_setup");
+    module->load = (PAnimSceneLoadFunc *) SDL_LoadFunction(module->library, "panim_module_load");
+    module->build = (PAnimSceneBuildFunc *) SDL_LoadFunction(module->library, "panim_module_build");
+    if (!module->setup || !module->load || !module->build) {
+        fprintf(stderr, "Error: %s wasn't built with PANIM_MODULE defined\n", module->path);
+        SDL_UnloadObject(module->library);
+        module->library = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+static bool module_changed(void *data) {
+    Module *module = (Module *) data;
+
+    long long time, size;
+    if (!file_info(module->path, &time, &size)) return false;
+    if (time == module->loaded_time && size == module->loaded_size) return false;
+
+    bool settled = time == module->polled_time && size == module->polled_size;
+    module->polled_time = time;
+    module->polled_size = size;
+    return settled;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        printf("Usage: %s <SceneLibrary>\n", argv[0]);
+        return 2;
+    }
+
+    Module module = {0};
+    module.path = argv[1];
+    if (!load_module(&module)) return 1;
+
+    PAnimScene scene = {0};
+    module.setup(&scene);
+    PAnimEngine pnm = panim_engine_begin_preview(&scene);
+    module.load(&pnm);
+    module.build(&scene);
+    panim_scene_finalize(&scene);
+
+    PAnimPlayback playback = panim_playback_default();
+    playback.reload = module_changed;
+    playback.reload_data = &module;
+
+    while (panim_scene_preview(&pnm, &scene, NULL, &playback)) {
+        Uint64 begin = SDL_GetPerformanceCounter();
+
+        Module next = module;
+        next.generation += 1;
+        if (!load_module(&next)) {
+            // Keep showing the old scene until the next build
+            module.loaded_time = next.loaded_time;
+            module.loaded_size = next.loaded_size;
+            continue;
+        }
+
+        // The window and rasterizer stay as they are
+        PAnimScene probe = {0};
+        next.setup(&probe);
+        if (probe.screen_width != scene.screen_width || probe.screen_height != scene.screen_height) {
+            fprintf(stderr, "Error: the screen size changed, restart to see the new scene\n");
+            SDL_UnloadObject(next.library);
+            module.loaded_time = next.loaded_time;
+            module.loaded_size = next.loaded_size;
+            continue;
+        }
+
+        // Events point into the scene, so the new one is built in place
+        panim_scene_destroy(&scene);
+        SDL_UnloadObject(module.library);
+        remove(module.live_path);
+        module = next;
+
+        module.setup(&scene);
+        module.load(&pnm);
+        module.build(&scene);
+        panim_scene_finalize(&scene);
+
+        double ms = (double)(SDL_GetPerformanceCounter() - begin) * 1000 / SDL_GetPerformanceFrequency();
+        printf("Reloaded %s in %.0f ms\n", module.path, ms);
+    }
+
+    panim_scene_destroy(&scene);
+    panim_engine_end_preview(&pnm);
+    SDL_UnloadObject(module.library);
+    remove(module.live_path);
+    return 0;
+}
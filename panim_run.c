@@ -0,0 +1,48 @@
+/***********************************************************
+ Compiled Scene Runner
+
+ Previews or renders a scene written with --compile,
+ without the code that built it. Takes the same options
+ as the scene executables, after the compiled scene:
+
+     panim_run huffmans_alg.pnms --jobs 4 out.mp4
+
+ The scene can also be given in PANIM_SCENE instead,
+ which is how the processes rendering --segments get it.
+ Image and font paths are looked up as they were given
+ to panim_engine_load_image and panim_engine_load_font.
+
+ To build:
+     cl /O2 panim_run.c /Febin\panim_run.exe /Iinclude /Isrc /D_CRT_SECURE_NO_WARNINGS /link /libpath:lib avcodec.lib avformat.lib avutil.lib swscale.lib x64\SDL2.lib x64\SDL2main.lib x64\SDL2_image.lib x64\SDL2_ttf.lib
+***********************************************************/
+
+#include "panim.h"
+
+int main(int argc, char *argv[]) {
+    const char *scene_file = SDL_getenv("PANIM_SCENE");
+    if (!scene_file) {
+        if (argc < 2) {
+            printf("Usage: %s <CompiledScene> [Options]\n", argv[0]);
+            return 2;
+        }
+        
+        // Pass the scene on to child processes, and hide it from panim_main
+        scene_file = argv[1];
+#ifdef _WIN32
+        _putenv_s("PANIM_SCENE", scene_file);
+#else
+        setenv("PANIM_SCENE", scene_file, 1);
+#endif
+        argv[1] = argv[0];
+        argv += 1;
+        argc -= 1;
+    }
+    
+    PAnimScene scene;
+    panim_scene_load(&scene, scene_file);
+    
+    PAnimEngine pnm = panim_engine_begin_preview(&scene);
+    panim_scene_load_assets(&pnm, &scene);
+    
+    return panim_main(argc, argv, &pnm, &scene);
+}
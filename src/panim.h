@@ -5,31 +5,75 @@ Notice: No warranty is offered or implied; use this code at your own risk.
 
 #include "assert.h"
 #include "stdbool.h"
+#include "math.h"
+#include "setjmp.h"
 #include "stdio.h"
 #include "stdint.h"
+#include "stdlib.h"
+#include "string.h"
 
 #include "SDL/SDL.h"
 #include "SDL/SDL_image.h"
 #include "SDL/SDL_ttf.h"
 #undef main
 
+#include "panim_kernels.h"
+#include "panim_trace.h"
+
 #include "libavformat/avformat.h"
 #include "libavcodec/avcodec.h"
 #include "libswscale/swscale.h"
 
 #define ERROR(E) do { fprintf(stderr, "Error: " E "\n"); exit(1); } while (0)
 
+// 64-bit file offsets, truncating open files, creating directories,
+// and mapping files into memory
+#ifdef _WIN32
+#include "io.h"
+#include "direct.h"
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#define NOGDI
+#include "windows.h"
+#define PNM_FSEEK _fseeki64
+#define PNM_FTELL _ftelli64
+#define PNM_TRUNCATE(file, size) _chsize_s(_fileno(file), (size))
+#define PNM_MKDIR(path) _mkdir(path)
+#else
+#include "unistd.h"
+#include "fcntl.h"
+#include "sys/stat.h"
+#include "sys/mman.h"
+#define PNM_FSEEK fseeko
+#define PNM_FTELL ftello
+#define PNM_TRUNCATE(file, size) ftruncate(fileno(file), (off_t)(size))
+#define PNM_MKDIR(path) mkdir((path), 0777)
+#endif
+
 // Stretchy buffers, invented (?) by Sean Barrett, code adapted from
 // https://github.com/pervognsen/bitwise/blob/654cd758c421ba8f278d5eee161c91c81d9044b3/ion/common.c#L117-L153
 
 #define MAX(x, y) ((x) >= (y) ? (x) : (y))
+#define MIN(x, y) ((x) <= (y) ? (x) : (y))
 
 typedef struct BufHdr {
     size_t len;
     size_t cap;
+    
+    // Bytes of address space set aside by buf_reserve_virtual, of which the
+    // first `committed` are usable, both zero for buffers on the heap
+    size_t reserved;
+    size_t committed;
     char buf[];
 } BufHdr;
 
+// All buffers on the heap go through these, define both before including
+// this file to allocate them elsewhere
+#ifndef BUF_REALLOC
+#define BUF_REALLOC(ptr, size) realloc((ptr), (size))
+#define BUF_FREE(ptr) free(ptr)
+#endif
+
 #define buf__hdr(b) ((BufHdr *)((char *)(b) - offsetof(BufHdr, buf)))
 
 #define buf_len(b) ((b) ? buf__hdr(b)->len : 0)
@@ -37,45 +81,301 @@ typedef struct BufHdr {
 #define buf_end(b) ((b) + buf_len(b))
 #define buf_sizeof(b) ((b) ? buf_len(b)*sizeof(*b) : 0)
 
-#define buf_free(b) ((b) ? (free(buf__hdr(b)), (b) = NULL) : 0)
+#define buf_free(b) ((b) ? (buf__free(b), (b) = NULL) : 0)
 #define buf_fit(b, n) ((n) <= buf_cap(b) ? 0 : ((b) = buf__grow((b), (n), sizeof(*(b)))))
 #define buf_push(b, ...) (buf_fit((b), 1 + buf_len(b)), (b)[buf__hdr(b)->len++] = (__VA_ARGS__))
 #define buf_clear(b) ((b) ? buf__hdr(b)->len = 0 : 0)
 
-void *buf__grow(const void *buf, size_t new_len, size_t elem_size) {
-    assert(buf_cap(buf) <= (SIZE_MAX - 1)/2);
-    size_t new_cap = MAX(16, MAX(1 + 2*buf_cap(buf), new_len));
-    assert(new_len <= new_cap);
+// Unlike buf_fit, grows to exactly `n` elements, for when the final size
+// is known up front. buf_shrink_to_fit gives back what is left over.
+#define buf_reserve(b, n) ((n) <= buf_cap(b) ? 0 : ((b) = buf__set_cap((b), (n), sizeof(*(b)))))
+#define buf_shrink_to_fit(b) ((b) ? ((b) = buf__shrink_to_fit((b), sizeof(*(b)))) : 0)
+
+// Sets aside address space for `n` elements for the empty buffer `b`, which
+// then grows by committing more of it, without ever being moved or copied.
+// Where that isn't possible, e.g. in 32-bit builds, it stays on the heap.
+#define buf_reserve_virtual(b, n) (assert(!(b)), (b) = buf__reserve_virtual((n), sizeof(*(b))))
+
+// qsort must not be passed NULL, even for zero elements. Scenes built in
+// bulk are mostly in order already, which takes a single pass to find out.
+#define buf_sort(b, cmp) ((b) && !buf__sorted((b), buf_len(b), sizeof(*(b)), \
+                                              (int (*)(const void *, const void *))(cmp)) \
+                          ? qsort((b), buf_len(b), sizeof(*(b)), \
+                                  (int (*)(const void *, const void *))(cmp)) : (void)0)
+
+size_t buf__page_size(void) {
+    static size_t page_size;
+    if (!page_size) {
+#ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        page_size = info.dwPageSize;
+#else
+        page_size = (size_t) sysconf(_SC_PAGESIZE);
+#endif
+    }
+    return page_size;
+}
+
+// Commits or decommits whole pages, so that at least `size` bytes of the
+// reservation are usable, returns false if the system is out of memory
+bool buf__commit(BufHdr *hdr, size_t size) {
+    size_t page_size = buf__page_size();
+    size = MAX(page_size, (size + page_size - 1) & ~(page_size - 1));
+    char *base = (char *)hdr;
+    if (size > hdr->committed) {
+#ifdef _WIN32
+        if (!VirtualAlloc(base + hdr->committed, size - hdr->committed, MEM_COMMIT, PAGE_READWRITE)) return false;
+#else
+        if (mprotect(base + hdr->committed, size - hdr->committed, PROT_READ | PROT_WRITE) != 0) return false;
+#endif
+    } else if (size < hdr->committed) {
+#ifdef _WIN32
+        VirtualFree(base + size, hdr->committed - size, MEM_DECOMMIT);
+#else
+        madvise(base + size, hdr->committed - size, MADV_DONTNEED);
+        mprotect(base + size, hdr->committed - size, PROT_NONE);
+#endif
+    }
+    hdr->committed = size;
+    return true;
+}
+
+void *buf__reserve_virtual(size_t max_len, size_t elem_size) {
+    size_t page_size = buf__page_size();
+    assert(max_len <= (SIZE_MAX - offsetof(BufHdr, buf) - page_size)/elem_size);
+    size_t reserved = (offsetof(BufHdr, buf) + max_len*elem_size + page_size - 1) & ~(page_size - 1);
+    
+    // The header's page is committed right away
+#ifdef _WIN32
+    BufHdr *hdr = (BufHdr *) VirtualAlloc(NULL, reserved, MEM_RESERVE, PAGE_NOACCESS);
+    if (hdr && !VirtualAlloc(hdr, page_size, MEM_COMMIT, PAGE_READWRITE)) {
+        VirtualFree(hdr, 0, MEM_RELEASE);
+        hdr = NULL;
+    }
+#else
+    BufHdr *hdr = (BufHdr *) mmap(NULL, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (hdr == (BufHdr *) MAP_FAILED) {
+        hdr = NULL;
+    } else if (mprotect(hdr, page_size, PROT_READ | PROT_WRITE) != 0) {
+        munmap(hdr, reserved);
+        hdr = NULL;
+    }
+#endif
+    if (!hdr) return NULL;
+    
+    hdr->len = 0;
+    hdr->reserved = reserved;
+    hdr->committed = page_size;
+    hdr->cap = (page_size - offsetof(BufHdr, buf))/elem_size;
+    return hdr->buf;
+}
+
+void *buf__set_cap(const void *buf, size_t new_cap, size_t elem_size) {
     assert(new_cap <= (SIZE_MAX - offsetof(BufHdr, buf))/elem_size);
     size_t new_size = offsetof(BufHdr, buf) + new_cap*elem_size;
     BufHdr *new_hdr;
+    if (buf && buf__hdr(buf)->reserved) {
+        new_hdr = buf__hdr(buf);
+        if (new_size > new_hdr->reserved) ERROR("buffer outgrew its reserved address space!");
+        if (!buf__commit(new_hdr, new_size)) ERROR("out of memory!");
+        
+        // Whole pages are committed, so there may be room for more
+        new_hdr->cap = (new_hdr->committed - offsetof(BufHdr, buf))/elem_size;
+        return new_hdr->buf;
+    }
+    
     if (buf) {
-        new_hdr = realloc(buf__hdr(buf), new_size);
+        new_hdr = BUF_REALLOC(buf__hdr(buf), new_size);
+        if (!new_hdr) ERROR("out of memory!");
     } else {
-        new_hdr = malloc(new_size);
+        new_hdr = BUF_REALLOC(NULL, new_size);
+        if (!new_hdr) ERROR("out of memory!");
         new_hdr->len = 0;
+        new_hdr->reserved = 0;
+        new_hdr->committed = 0;
     }
     new_hdr->cap = new_cap;
     return new_hdr->buf;
 }
 
+void *buf__grow(const void *buf, size_t new_len, size_t elem_size) {
+    assert(buf_cap(buf) <= (SIZE_MAX - 1)/2);
+    size_t new_cap = MAX(16, MAX(1 + 2*buf_cap(buf), new_len));
+    assert(new_len <= new_cap);
+    
+    // Doubling is only there to amortize copies, which reserved buffers
+    // never need, so they only grow up to the end of their reservation
+    if (buf && buf__hdr(buf)->reserved) {
+        size_t max_cap = (buf__hdr(buf)->reserved - offsetof(BufHdr, buf))/elem_size;
+        new_cap = MAX(new_len, MIN(new_cap, max_cap));
+    }
+    return buf__set_cap(buf, new_cap, elem_size);
+}
+
+void *buf__shrink_to_fit(void *buf, size_t elem_size) {
+    BufHdr *hdr = buf__hdr(buf);
+    size_t size = offsetof(BufHdr, buf) + hdr->len*elem_size;
+    if (hdr->reserved) {
+        buf__commit(hdr, size);
+        hdr->cap = (hdr->committed - offsetof(BufHdr, buf))/elem_size;
+        return buf;
+    }
+    
+    if (hdr->cap == hdr->len) return buf;
+    hdr = BUF_REALLOC(hdr, size);
+    if (!hdr) ERROR("out of memory!");
+    hdr->cap = hdr->len;
+    return hdr->buf;
+}
+
+void buf__free(void *buf) {
+    BufHdr *hdr = buf__hdr(buf);
+    if (hdr->reserved) {
+#ifdef _WIN32
+        VirtualFree(hdr, 0, MEM_RELEASE);
+#else
+        munmap(hdr, hdr->reserved);
+#endif
+    } else {
+        BUF_FREE(hdr);
+    }
+}
+
+bool buf__sorted(const void *buf, size_t len, size_t elem_size,
+                 int (*cmp)(const void *, const void *)) {
+    const char *elem = (const char *)buf;
+    for (size_t i = 1; i < len; ++i, elem += elem_size) {
+        if (cmp(elem, elem + elem_size) > 0) return false;
+    }
+    return true;
+}
+
+// XXH64 by Yann Collet, see https://github.com/Cyan4973/xxHash
+// Reads input words in native byte order, so hashes of the same data only
+// agree between little-endian machines, which is all we support anyway.
+
+#define PNM_PRIME64_1 0x9E3779B185EBCA87ULL
+#define PNM_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PNM_PRIME64_3 0x165667B19E3779F9ULL
+#define PNM_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PNM_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t
+panim_rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+panim_hash_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PNM_PRIME64_2;
+    return panim_rotl64(acc, 31) * PNM_PRIME64_1;
+}
+
+static inline uint64_t
+panim_hash_merge(uint64_t acc, uint64_t value)
+{
+    acc ^= panim_hash_round(0, value);
+    return acc * PNM_PRIME64_1 + PNM_PRIME64_4;
+}
+
+static uint64_t
+panim_hash64(const void * data, size_t size, uint64_t seed)
+{
+    const uint8_t *p = (const uint8_t *) data;
+    const uint8_t *end = p + size;
+    uint64_t h, word;
+    uint32_t half;
+    
+    if (size >= 32) {
+        uint64_t v1 = seed + PNM_PRIME64_1 + PNM_PRIME64_2;
+        uint64_t v2 = seed + PNM_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PNM_PRIME64_1;
+        for (; p + 32 <= end; p += 32) {
+            memcpy(&word, p +  0, 8); v1 = panim_hash_round(v1, word);
+            memcpy(&word, p +  8, 8); v2 = panim_hash_round(v2, word);
+            memcpy(&word, p + 16, 8); v3 = panim_hash_round(v3, word);
+            memcpy(&word, p + 24, 8); v4 = panim_hash_round(v4, word);
+        }
+        
+        h = panim_rotl64(v1, 1) + panim_rotl64(v2, 7) +
+            panim_rotl64(v3, 12) + panim_rotl64(v4, 18);
+        h = panim_hash_merge(h, v1);
+        h = panim_hash_merge(h, v2);
+        h = panim_hash_merge(h, v3);
+        h = panim_hash_merge(h, v4);
+    } else {
+        h = seed + PNM_PRIME64_5;
+    }
+    
+    h += (uint64_t) size;
+    for (; p + 8 <= end; p += 8) {
+        memcpy(&word, p, 8);
+        h ^= panim_hash_round(0, word);
+        h = panim_rotl64(h, 27) * PNM_PRIME64_1 + PNM_PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        memcpy(&half, p, 4);
+        h ^= (uint64_t) half * PNM_PRIME64_1;
+        h = panim_rotl64(h, 23) * PNM_PRIME64_2 + PNM_PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h ^= (uint64_t) *p * PNM_PRIME64_5;
+        h = panim_rotl64(h, 11) * PNM_PRIME64_1;
+    }
+    
+    h ^= h >> 33;
+    h *= PNM_PRIME64_2;
+    h ^= h >> 29;
+    h *= PNM_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
 typedef enum PAnimObjType {
     PNM_OBJ_INVALID,
     PNM_OBJ_IMAGE,
     PNM_OBJ_TEXT,
     PNM_OBJ_LINE,
+    PNM_OBJ_GROUP,
 } PAnimObjType;
 
+typedef enum PAnimLineCap {
+    PNM_LINE_CAP_BUTT,   // ends exactly at the end points
+    PNM_LINE_CAP_SQUARE, // extends past the end points by half the width
+    PNM_LINE_CAP_ROUND,  // half a disc around each end point
+} PAnimLineCap;
+
 typedef enum PAnimTextAlignment {
     PNM_TXT_ALIGN_LEFT,
     PNM_TXT_ALIGN_CENTER,
     PNM_TXT_ALIGN_RIGHT,
 } PAnimTextAlignment;
 
-typedef struct {
+#define PNM_FRAME_NEVER SIZE_MAX
+
+typedef struct PAnimObject {
     PAnimObjType type;
     int depth_level;
     SDL_Color color;
+    uint32_t order; // of creation, so objects at the same depth always draw the same way
+    
+    // Positions are relative to the parent group, if any, and the parent's
+    // alpha multiplies into this object's own. Groups themselves are never
+    // drawn, they only carry a transform for their children.
+    struct PAnimObject * parent;
+    
+    // The object is only considered for drawing in the frames
+    // [spawn_frame, despawn_frame). panim_scene_finalize narrows this
+    // further down for objects that are invisible before their first
+    // fade-in or after their last fade-out.
+    size_t spawn_frame;
+    size_t despawn_frame;
+    
     union {
         struct {
             SDL_Texture * texture;
@@ -87,11 +387,30 @@ typedef struct {
             int center_x;
             int center_y;
             PAnimTextAlignment align;
+            int w, h; // measured lazily, zero until the first visibility test
+            uint32_t last_drawn; // see PAnimScene.text_clock
+            SDL_Texture * texture; // rendered once, when first drawn
+            SDL_Surface * surface; // same, for the CPU backend
+            uint64_t hash; // of `surface`, zero until a render cache needs it
         } txt;
         struct {
             int x1, y1;
             int x2, y2;
+            float width;
+            PAnimLineCap cap;
         } line;
+        struct {
+            int x, y;
+            int level; // number of ancestors, determines update order
+            
+            // World transform, recomputed by panim_scene_update_transforms
+            // only when the local values below or the parent's transform change
+            int world_x, world_y;
+            unsigned char world_alpha;
+            int cached_x, cached_y;
+            unsigned char cached_alpha;
+            bool changed;
+        } grp;
     };
 } PAnimObject;
 
@@ -100,27 +419,32 @@ typedef enum PAnimEventType {
     PNM_EVENT_COLOR_FADE,
     PNM_EVENT_MOVEMENT,
     PNM_EVENT_COLOCATE,
+    PNM_EVENT_TWEEN,
 } PAnimEventType;
 
+// Events store their timing in 32 bits, see panim_event_set_timing
+#define PNM_EVENT_MAX_LENGTH ((1u << 24) - 1)
+
+/*
+ * Updating a frame streams through all active events, so they are kept
+ * compact, and never written to during playback: the state an event starts
+ * from is kept in the active list instead, see PAnimActiveEvent.
+ */
 typedef struct {
-    PAnimEventType type;
-    size_t begin_frame;
-    size_t length;
+    uint32_t begin_frame;
+    uint32_t length : 24;
+    uint32_t type : 7; // PAnimEventType
+    uint32_t relative : 1; // moves only, the target is an offset
     union {
         struct {
-            SDL_Color * value;
+            PAnimObject * object;
             SDL_Color new_color;
-            SDL_Color old_color; // initialized during playback when the animation begins
         } colfd;
         struct {
             int * x_val;
             int * y_val;
             int x_target;
             int y_target;
-            // initialized during playback when the animation begins
-            int x_old;
-            int y_old;
-            bool relative;
         } move;
         struct {
             PAnimObject * src;
@@ -128,24 +452,262 @@ typedef struct {
             int x_offset;
             int y_offset;
         } copy_pos;
+        struct {
+            float * value;
+            float target;
+        } tween;
     };
 } PAnimEvent;
 
+/*
+ * An event that began but isn't over yet, along with the state it started
+ * from, which is only known once it begins.
+ */
+typedef struct {
+    uint32_t event; // index into PAnimScene.timeline
+    union {
+        SDL_Color color;
+        struct { int x, y; } pos;
+        float value;
+    } old;
+} PAnimActiveEvent;
+
+typedef struct {
+    uint32_t frame;
+    uint32_t object; // index into PAnimScene.objects
+} PAnimLifetimeMark;
+
+// MSVC's C compiler has no _Static_assert, but a negative array size fails just as well
+#define PNM_STATIC_ASSERT(cond, name) typedef char pnm_static_assert_##name[(cond) ? 1 : -1]
+
+PNM_STATIC_ASSERT(sizeof(PAnimEvent) <= 32, event_size);
+PNM_STATIC_ASSERT(sizeof(PAnimActiveEvent) <= 12, active_event_size);
+PNM_STATIC_ASSERT(sizeof(PAnimLifetimeMark) == 8, lifetime_mark_size);
+
+/*
+ * The view onto the scene: world position (x, y) is drawn at the top left of
+ * the screen at a zoom of 1, zooming scales around the center of the screen.
+ */
+typedef struct {
+    int x, y;
+    float zoom; // treated as 1 if left at zero
+} PAnimCamera;
+
 typedef struct {
     size_t length_in_frames;
     int screen_width;
     int screen_height;
     
+    PAnimCamera camera;
     SDL_Color bg_color;
     PAnimObject ** objects;
+    PAnimObject ** groups; // ordered parents-first by panim_scene_finalize
     PAnimEvent   * timeline;
+    
+    // Derived in panim_scene_finalize, ordered by the frame in which the
+    // respective object spawns or despawns.
+    PAnimLifetimeMark * spawn_order;
+    PAnimLifetimeMark * despawn_order;
+    
+    // Indices of all objects alive in the most recently updated frame,
+    // kept in ascending order, i.e. sorted by depth level.
+    size_t * live;
+    size_t live_frame;
+    size_t next_spawn;
+    size_t next_despawn;
+    
+    // The events that began but aren't over yet in the most recently
+    // updated frame, in timeline order, see panim_scene_update_active
+    PAnimActiveEvent * active;
+    size_t next_event; // first event in the timeline that hasn't begun yet
+    
+    // The frames that need to be replayed when seeking, see panim_scene_seek
+    uint32_t * key_frames;
+    size_t frame; // most recently updated, PNM_FRAME_NEVER before the first
+    
+    // Frames before this one can't change anymore, see panim_scene_seal
+    size_t sealed_frame;
+    struct PAnimSceneStream * stream; // set while built for a streaming preview
+    
+    // Text objects whose texture or surface panim_scene_frame_render had to
+    // render, which it may free again to stay within the engine's budget,
+    // see panim_scene_evict_text
+    PAnimObject ** text_cache;
+    size_t text_cache_bytes; // estimated, recounted whenever it's over budget
+    uint32_t text_clock; // counts rendered frames, for finding text drawn least recently
+    bool text_shared; // text surfaces are shared with copies, see panim_scene_prepare_text
+    
+    // Objects, groups and text are allocated from these blocks, so a scene
+    // can be thrown away at once, see panim_scene_alloc
+    char ** arena;
+    size_t arena_used; // bytes of the last block
+    
+    // The mapped file for scenes loaded with panim_scene_load, which all
+    // buffers except `live` point into, NULL for scenes built in code
+    char * file;
+    size_t file_size;
 } PAnimScene;
 
+/*
+ * A single draw call in screen space, as collected by panim_scene_frame_render.
+ */
+typedef struct {
+    PAnimObjType type;
+    int depth_level;
+    uint32_t order; // of the object, see PAnimObject.order
+    SDL_Texture * texture; // for lines, the strip texture of their width
+    SDL_Surface * surface; // source pixels for the CPU backend
+    SDL_BlendMode blend;
+    SDL_Color color;
+    union {
+        SDL_Rect dst;
+        struct {
+            int x1, y1;
+            int x2, y2;
+            float width;
+            PAnimLineCap cap;
+        } line;
+    };
+} PAnimDrawCmd;
+
+/*
+ * Lines are drawn as rotated copies of a strip texture whose alpha is the
+ * line's coverage across its width, with discs of the same coverage profile
+ * for round caps. Both are generated once per distinct width.
+ */
+typedef struct {
+    int width_key; // width in quarter pixels
+    SDL_Texture * strip;
+    SDL_Texture * disc;
+    int strip_h;
+    int disc_d;
+} PAnimLineTextures;
+
+typedef enum PAnimBackend {
+    PNM_BACKEND_SDL, // SDL_Renderer, hardware accelerated where available
+    PNM_BACKEND_CPU, // tile-based software rasterizer on a thread pool
+} PAnimBackend;
+
+/*
+ * An image loaded through panim_engine_load_image. The CPU backend needs
+ * the pixel data, which we can't get back out of an SDL_Texture.
+ */
+typedef struct {
+    SDL_Texture * texture;
+    SDL_Surface * surface; // ARGB8888, premultiplied
+    uint64_t hash; // of the pixels, identifies the image in render caches
+    char * filename;
+} PAnimImage;
+
+/*
+ * A font loaded through panim_engine_load_font. Compiled scenes refer to
+ * fonts and images by file name, so both need to be remembered.
+ */
+typedef struct {
+    TTF_Font * font;
+    char * filename;
+    int size;
+} PAnimFont;
+
+typedef void PAnimJobFunc(void * data, int index);
+
+/*
+ * Fixed set of worker threads that cooperatively run `job_count` jobs,
+ * handing out job indices through an atomic counter. The calling thread
+ * works along, so a pool with one thread in total spawns no workers.
+ */
+typedef struct {
+    SDL_Thread ** threads;
+    int thread_count;
+    SDL_sem * start;
+    SDL_sem * done;
+    
+    SDL_atomic_t next_index;
+    int job_count;
+    PAnimJobFunc * job;
+    void * job_data;
+    bool quit;
+} PAnimThreadPool;
+
+#define PNM_TILE_SIZE 64
+
 typedef struct {
-    SDL_Window   * window;
+    Uint32 * pixels; // ARGB8888, premultiplied, tightly packed
+    int width;
+    int height;
+    
+    // Indices into the engine's draw list of the draw calls overlapping
+    // each tile, in draw order
+    int tiles_x;
+    int tiles_y;
+    uint32_t ** tile_cmds;
+    
+    PAnimDrawCmd * cmds;
+    SDL_Color bg_color;
+    
+    const PAnimKernels * kernels;
+    PAnimThreadPool pool;
+    SDL_Texture * present; // streaming texture showing `pixels` in the window
+} PAnimRaster;
+
+typedef struct {
+    PAnimBackend backend;
+    SDL_Window   * window; // NULL when running headless
     SDL_Renderer * renderer;
+    
+    PAnimDrawCmd * draw_list; // reused across frames
+    size_t batch_count;       // for the most recently rendered frame
+    
+    PAnimLineTextures * line_textures;
+    PAnimImage * images;
+    PAnimFont * fonts;
+    PAnimRaster * raster; // CPU backend only
+    size_t text_budget; // bytes of rendered text per scene, zero for no limit
+    
+    // Images and fonts can only be loaded from the thread that started the
+    // engine, as the renderer belongs to it
+    SDL_threadID main_thread;
 } PAnimEngine;
 
+#define PNM_ARENA_BLOCK_SIZE (64 * 1024)
+
+static void panim_scene_stream_poll(struct PAnimSceneStream * stream);
+
+static void *
+panim_scene_alloc(PAnimScene * scene, size_t size)
+{
+    if (scene->stream) panim_scene_stream_poll(scene->stream);
+    size = (size + 15) & ~(size_t)15;
+    
+    // Large arrays get a block of their own, slotted in before the block
+    // that is being filled, which stays last
+    if (size > PNM_ARENA_BLOCK_SIZE / 4) {
+        char *block = (char *) malloc(size);
+        if (!block) ERROR("out of memory!");
+        buf_push(scene->arena, block);
+        
+        size_t count = buf_len(scene->arena);
+        if (count > 1) {
+            scene->arena[count - 1] = scene->arena[count - 2];
+            scene->arena[count - 2] = block;
+        } else {
+            scene->arena_used = PNM_ARENA_BLOCK_SIZE;
+        }
+        return block;
+    }
+    
+    if (!scene->arena || scene->arena_used + size > PNM_ARENA_BLOCK_SIZE) {
+        char *block = (char *) malloc(PNM_ARENA_BLOCK_SIZE);
+        if (!block) ERROR("out of memory!");
+        buf_push(scene->arena, block);
+        scene->arena_used = 0;
+    }
+    
+    void *result = scene->arena[buf_len(scene->arena) - 1] + scene->arena_used;
+    scene->arena_used += size;
+    return result;
+}
+
 /*
  * Pushes a new image object onto the scene.
  */
@@ -155,9 +717,12 @@ panim_scene_add_image(PAnimScene * scene,
                       int center_x, int center_y,
                       int depth_level)
 {
-    PAnimObject *obj = (PAnimObject *) malloc(sizeof(PAnimObject));
+    PAnimObject *obj = (PAnimObject *) panim_scene_alloc(scene, sizeof(PAnimObject));
     obj->type = PNM_OBJ_IMAGE;
     obj->depth_level = depth_level;
+    obj->parent = NULL;
+    obj->spawn_frame = scene->sealed_frame;
+    obj->despawn_frame = PNM_FRAME_NEVER;
     obj->color = mod_color;
     obj->img.texture = img;
     
@@ -168,31 +733,42 @@ panim_scene_add_image(PAnimScene * scene,
         .w = w, .h = h
     };
     
+    obj->order = (uint32_t) buf_len(scene->objects);
     buf_push(scene->objects, obj);
     return obj;
 }
 
 /*
- * Pushes a new text object onto the scene, taking ownership of `text`.
+ * Pushes a new text object onto the scene, with a copy of `text`.
  */
 static PAnimObject *
 panim_scene_add_text(PAnimScene * scene,
-                     TTF_Font * font, char * text,
+                     TTF_Font * font, const char * text,
                      SDL_Color color,
                      int center_x, int center_y,
                      PAnimTextAlignment alignment,
                      int depth_level)
 {
-    PAnimObject *obj = (PAnimObject *) malloc(sizeof(PAnimObject));
+    PAnimObject *obj = (PAnimObject *) panim_scene_alloc(scene, sizeof(PAnimObject));
     obj->type = PNM_OBJ_TEXT;
     obj->depth_level = depth_level;
+    obj->parent = NULL;
+    obj->spawn_frame = scene->sealed_frame;
+    obj->despawn_frame = PNM_FRAME_NEVER;
     obj->color = color;
     obj->txt.font = font;
-    obj->txt.data = text;
+    obj->txt.data = (char *) panim_scene_alloc(scene, strlen(text) + 1);
+    strcpy(obj->txt.data, text);
     obj->txt.center_x = center_x;
     obj->txt.center_y = center_y;
     obj->txt.align = alignment;
+    obj->txt.w = 0;
+    obj->txt.h = 0;
+    obj->txt.texture = NULL;
+    obj->txt.surface = NULL;
+    obj->txt.hash = 0;
     
+    obj->order = (uint32_t) buf_len(scene->objects);
     buf_push(scene->objects, obj);
     return obj;
 }
@@ -207,19 +783,240 @@ panim_scene_add_line(PAnimScene * scene,
                      int x2, int y2,
                      int depth_level)
 {
-    PAnimObject *obj = (PAnimObject *) malloc(sizeof(PAnimObject));
+    PAnimObject *obj = (PAnimObject *) panim_scene_alloc(scene, sizeof(PAnimObject));
     obj->type = PNM_OBJ_LINE;
     obj->depth_level = depth_level;
+    obj->parent = NULL;
+    obj->spawn_frame = scene->sealed_frame;
+    obj->despawn_frame = PNM_FRAME_NEVER;
     obj->color = color;
     obj->line.x1 = x1;
     obj->line.y1 = y1;
     obj->line.x2 = x2;
     obj->line.y2 = y2;
+    obj->line.width = 1.0f;
+    obj->line.cap = PNM_LINE_CAP_BUTT;
     
+    obj->order = (uint32_t) buf_len(scene->objects);
     buf_push(scene->objects, obj);
     return obj;
 }
 
+static inline void
+panim_line_set_style(PAnimObject * line, float width, PAnimLineCap cap)
+{
+    assert(line->type == PNM_OBJ_LINE);
+    line->line.width = width;
+    line->line.cap = cap;
+}
+
+/*
+ * Pushes a new group onto the scene. Moving or fading a group affects all
+ * of its descendants, at the cost of a single event.
+ */
+static PAnimObject *
+panim_scene_add_group(PAnimScene * scene, PAnimObject * parent, int x, int y)
+{
+    PAnimObject *obj = (PAnimObject *) panim_scene_alloc(scene, sizeof(PAnimObject));
+    obj->type = PNM_OBJ_GROUP;
+    obj->depth_level = 0;
+    obj->color = (SDL_Color){ 0xFF, 0xFF, 0xFF, 0xFF };
+    obj->parent = parent;
+    obj->spawn_frame = scene->sealed_frame;
+    obj->despawn_frame = PNM_FRAME_NEVER;
+    obj->grp.x = x;
+    obj->grp.y = y;
+    obj->grp.level = 0;
+    obj->grp.changed = false;
+    
+    buf_push(scene->groups, obj);
+    return obj;
+}
+
+/*
+ * Reserves `count` contiguous objects, already pushed onto `objects`. The
+ * bulk versions of the functions above fill them in with a single call,
+ * which is much faster than adding objects one by one for large counts.
+ */
+static PAnimObject *
+panim_scene_push_objects(PAnimScene * scene, PAnimObject *** objects, size_t count)
+{
+    if (count == 0) return NULL;
+    
+    PAnimObject *block = (PAnimObject *) panim_scene_alloc(scene, count * sizeof(PAnimObject));
+    buf_fit(*objects, buf_len(*objects) + count);
+    PAnimObject **slots = buf_end(*objects);
+    for (size_t i = 0; i < count; ++i) {
+        block[i].order = (uint32_t)(buf_len(*objects) + i);
+        slots[i] = block + i;
+    }
+    buf__hdr(*objects)->len += count;
+    return block;
+}
+
+// Images of the same texture centered on each of `centers`, see above
+static PAnimObject *
+panim_scene_add_images(PAnimScene * scene,
+                       SDL_Texture * img, SDL_Color mod_color,
+                       const SDL_Point * centers, size_t count,
+                       int depth_level)
+{
+    PAnimObject *objs = panim_scene_push_objects(scene, &scene->objects, count);
+    int w, h; SDL_QueryTexture(img, NULL, NULL, &w, &h);
+    
+    for (size_t i = 0; i < count; ++i) {
+        PAnimObject *obj = objs + i;
+        obj->type = PNM_OBJ_IMAGE;
+        obj->depth_level = depth_level;
+        obj->parent = NULL;
+        obj->spawn_frame = scene->sealed_frame;
+        obj->despawn_frame = PNM_FRAME_NEVER;
+        obj->color = mod_color;
+        obj->img.texture = img;
+        obj->img.location = (SDL_Rect){
+            .x = centers[i].x - w/2,
+            .y = centers[i].y - h/2,
+            .w = w, .h = h
+        };
+    }
+    
+    return objs;
+}
+
+// Lines from points[2*i] to points[2*i + 1], see panim_scene_push_objects
+static PAnimObject *
+panim_scene_add_lines(PAnimScene * scene, SDL_Color color,
+                      const SDL_Point * points, size_t count,
+                      int depth_level)
+{
+    PAnimObject *objs = panim_scene_push_objects(scene, &scene->objects, count);
+    for (size_t i = 0; i < count; ++i) {
+        PAnimObject *obj = objs + i;
+        obj->type = PNM_OBJ_LINE;
+        obj->depth_level = depth_level;
+        obj->parent = NULL;
+        obj->spawn_frame = scene->sealed_frame;
+        obj->despawn_frame = PNM_FRAME_NEVER;
+        obj->color = color;
+        obj->line.x1 = points[2*i].x;
+        obj->line.y1 = points[2*i].y;
+        obj->line.x2 = points[2*i + 1].x;
+        obj->line.y2 = points[2*i + 1].y;
+        obj->line.width = 1.0f;
+        obj->line.cap = PNM_LINE_CAP_BUTT;
+    }
+    
+    return objs;
+}
+
+// Groups at each of `positions`, see panim_scene_push_objects
+static PAnimObject *
+panim_scene_add_groups(PAnimScene * scene, PAnimObject * parent,
+                       const SDL_Point * positions, size_t count)
+{
+    PAnimObject *objs = panim_scene_push_objects(scene, &scene->groups, count);
+    for (size_t i = 0; i < count; ++i) {
+        PAnimObject *obj = objs + i;
+        obj->type = PNM_OBJ_GROUP;
+        obj->depth_level = 0;
+        obj->color = (SDL_Color){ 0xFF, 0xFF, 0xFF, 0xFF };
+        obj->parent = parent;
+        obj->spawn_frame = scene->sealed_frame;
+        obj->despawn_frame = PNM_FRAME_NEVER;
+        obj->grp.x = positions[i].x;
+        obj->grp.y = positions[i].y;
+        obj->grp.level = 0;
+        obj->grp.changed = false;
+    }
+    
+    return objs;
+}
+
+static void
+panim_object_translate(PAnimObject * obj, int dx, int dy)
+{
+    switch (obj->type) {
+        case PNM_OBJ_IMAGE: {
+            obj->img.location.x += dx;
+            obj->img.location.y += dy;
+        } break;
+        case PNM_OBJ_TEXT: {
+            obj->txt.center_x += dx;
+            obj->txt.center_y += dy;
+        } break;
+        case PNM_OBJ_LINE: {
+            obj->line.x1 += dx; obj->line.y1 += dy;
+            obj->line.x2 += dx; obj->line.y2 += dy;
+        } break;
+        case PNM_OBJ_GROUP: {
+            obj->grp.x += dx;
+            obj->grp.y += dy;
+        } break;
+        default: __debugbreak();
+    }
+}
+
+/*
+ * Computes the world-space position of the local origin of `group`'s children
+ * from the current local positions along the chain of ancestors.
+ */
+static void
+panim_group_origin(PAnimObject * group, int * x, int * y)
+{
+    *x = 0; *y = 0;
+    for (; group; group = group->parent) {
+        *x += group->grp.x;
+        *y += group->grp.y;
+    }
+}
+
+/*
+ * Makes `obj` a child of `parent`, or a root object if `parent` is NULL.
+ * If `keep_world_position` is set, the object's current position is
+ * converted into the new parent's coordinate system, otherwise it is taken
+ * to be relative to the new parent as is.
+ *
+ * Either way, movement events on `obj` are interpreted in parent-local
+ * coordinates, so absolute moves should be added after parenting.
+ */
+static void
+panim_object_set_parent(PAnimObject * obj, PAnimObject * parent,
+                        bool keep_world_position)
+{
+    for (PAnimObject *p = parent; p; p = p->parent) {
+        assert(p != obj && "cycle in the scene graph");
+        assert(p->type == PNM_OBJ_GROUP);
+    }
+    
+    if (keep_world_position) {
+        int old_x, old_y; panim_group_origin(obj->parent, &old_x, &old_y);
+        int new_x, new_y; panim_group_origin(parent, &new_x, &new_y);
+        panim_object_translate(obj, old_x - new_x, old_y - new_y);
+    }
+    
+    obj->parent = parent;
+}
+
+/*
+ * Restricts the frames in which `obj` is drawn to [spawn_frame, despawn_frame).
+ */
+static inline void
+panim_object_set_lifetime(PAnimObject * obj,
+                          size_t spawn_frame, size_t despawn_frame)
+{
+    obj->spawn_frame = spawn_frame;
+    obj->despawn_frame = despawn_frame;
+}
+
+static inline void
+panim_event_set_timing(PAnimEvent * anim, size_t begin_frame, size_t length)
+{
+    assert(length <= PNM_EVENT_MAX_LENGTH && "event too long");
+    assert(begin_frame + length < UINT32_MAX && "event ends too late");
+    anim->begin_frame = (uint32_t) begin_frame;
+    anim->length = (uint32_t) length;
+}
+
 static void
 panim_scene_add_fade(PAnimScene * scene,
                      PAnimObject * obj,
@@ -227,11 +1024,13 @@ panim_scene_add_fade(PAnimScene * scene,
                      size_t begin_frame,
                      size_t length)
 {
-    PAnimEvent anim;
+    assert(begin_frame >= scene->sealed_frame && "event begins in a sealed frame");
+    if (scene->stream) panim_scene_stream_poll(scene->stream);
+    
+    PAnimEvent anim = {0};
     anim.type = PNM_EVENT_COLOR_FADE;
-    anim.begin_frame = begin_frame;
-    anim.length = length;
-    anim.colfd.value = &obj->color;
+    panim_event_set_timing(&anim, begin_frame, length);
+    anim.colfd.object = obj;
     anim.colfd.new_color = new_color;
     
     size_t anim_end_frame = begin_frame + length;
@@ -246,15 +1045,17 @@ panim_scene_add_move(PAnimScene * scene, int *x, int *y,
                      int target_x, int target_y, bool relative_move,
                      size_t begin_frame, size_t length)
 {
-    PAnimEvent anim;
+    assert(begin_frame >= scene->sealed_frame && "event begins in a sealed frame");
+    if (scene->stream) panim_scene_stream_poll(scene->stream);
+    
+    PAnimEvent anim = {0};
     anim.type = PNM_EVENT_MOVEMENT;
-    anim.begin_frame = begin_frame;
-    anim.length = length;
+    panim_event_set_timing(&anim, begin_frame, length);
     anim.move.x_val = x;
     anim.move.y_val = y;
     anim.move.x_target = target_x;
     anim.move.y_target = target_y;
-    anim.move.relative = relative_move;
+    anim.relative = relative_move;
     
     size_t anim_end_frame = begin_frame + length;
     if (anim_end_frame > scene->length_in_frames)
@@ -267,10 +1068,12 @@ static void
 panim_colocate(PAnimScene * scene, PAnimObject * dst, PAnimObject * src,
                int x_offset, int y_offset, size_t begin_frame)
 {
-    PAnimEvent anim;
+    assert(begin_frame >= scene->sealed_frame && "event begins in a sealed frame");
+    if (scene->stream) panim_scene_stream_poll(scene->stream);
+    
+    PAnimEvent anim = {0};
     anim.type = PNM_EVENT_COLOCATE;
-    anim.begin_frame = begin_frame;
-    anim.length = 0;
+    panim_event_set_timing(&anim, begin_frame, 0);
     anim.copy_pos.x_offset = x_offset;
     anim.copy_pos.y_offset = y_offset;
     anim.copy_pos.dst = dst;
@@ -283,22 +1086,145 @@ panim_colocate(PAnimScene * scene, PAnimObject * dst, PAnimObject * src,
     buf_push(scene->timeline, anim);
 }
 
-static inline PAnimObject *
-panim_fade_in_image(PAnimScene * scene, SDL_Texture * texture,
-                    int depth_level, int center_x, int center_y,
-                    size_t begin_frame, size_t length)
+/*
+ * Smoothly interpolates an arbitrary float towards `target`.
+ */
+static void
+panim_scene_add_tween(PAnimScene * scene, float * value, float target,
+                      size_t begin_frame, size_t length)
 {
-    PAnimObject *img = panim_scene_add_image(
-        scene, texture, (SDL_Color){ 0xFF, 0xFF, 0xFF, 0 },
-        center_x, center_y, depth_level);
-    panim_scene_add_fade(
-        scene, img, (SDL_Color){ 0xFF, 0xFF, 0xFF, 0xFF },
-        begin_frame, length);
+    assert(begin_frame >= scene->sealed_frame && "event begins in a sealed frame");
+    if (scene->stream) panim_scene_stream_poll(scene->stream);
+    
+    PAnimEvent anim = {0};
+    anim.type = PNM_EVENT_TWEEN;
+    panim_event_set_timing(&anim, begin_frame, length);
+    anim.tween.value = value;
+    anim.tween.target = target;
+    
+    size_t anim_end_frame = begin_frame + length;
+    if (anim_end_frame > scene->length_in_frames)
+        scene->length_in_frames = anim_end_frame;
+    
+    buf_push(scene->timeline, anim);
+}
+
+/*
+ * Reserves `count` events at the end of the timeline, with the same timing
+ * and everything else zeroed, for the bulk versions of the functions above.
+ */
+static PAnimEvent *
+panim_scene_push_events(PAnimScene * scene, size_t count,
+                        size_t begin_frame, size_t length)
+{
+    assert(begin_frame >= scene->sealed_frame && "event begins in a sealed frame");
+    if (scene->stream) panim_scene_stream_poll(scene->stream);
+    if (count == 0) return NULL;
+    
+    PAnimEvent timing = {0};
+    panim_event_set_timing(&timing, begin_frame, length);
+    
+    buf_fit(scene->timeline, buf_len(scene->timeline) + count);
+    PAnimEvent *events = buf_end(scene->timeline);
+    for (size_t i = 0; i < count; ++i) events[i] = timing;
+    buf__hdr(scene->timeline)->len += count;
+    
+    size_t anim_end_frame = begin_frame + length;
+    if (anim_end_frame > scene->length_in_frames)
+        scene->length_in_frames = anim_end_frame;
+    
+    return events;
+}
+
+// Fades each of `count` contiguous objects, e.g. from panim_scene_add_images
+static void
+panim_scene_add_fades(PAnimScene * scene,
+                      PAnimObject * objs, size_t count,
+                      SDL_Color new_color,
+                      size_t begin_frame, size_t length)
+{
+    PAnimEvent *events = panim_scene_push_events(scene, count, begin_frame, length);
+    for (size_t i = 0; i < count; ++i) {
+        PAnimEvent *anim = events + i;
+        anim->type = PNM_EVENT_COLOR_FADE;
+        anim->colfd.object = objs + i;
+        anim->colfd.new_color = new_color;
+    }
+}
+
+/*
+ * Moves each of `count` contiguous images, texts or groups to `targets[i]`,
+ * or by it if `relative_move` is set. Images are moved by their center.
+ */
+static void
+panim_scene_add_moves(PAnimScene * scene,
+                      PAnimObject * objs, size_t count,
+                      const SDL_Point * targets, bool relative_move,
+                      size_t begin_frame, size_t length)
+{
+    PAnimEvent *events = panim_scene_push_events(scene, count, begin_frame, length);
+    for (size_t i = 0; i < count; ++i) {
+        PAnimObject *obj = objs + i;
+        PAnimEvent *anim = events + i;
+        anim->type = PNM_EVENT_MOVEMENT;
+        anim->relative = relative_move;
+        anim->move.x_target = targets[i].x;
+        anim->move.y_target = targets[i].y;
+        
+        switch (obj->type) {
+            case PNM_OBJ_IMAGE: {
+                anim->move.x_val = &obj->img.location.x;
+                anim->move.y_val = &obj->img.location.y;
+                if (!relative_move) {
+                    anim->move.x_target -= obj->img.location.w / 2;
+                    anim->move.y_target -= obj->img.location.h / 2;
+                }
+            } break;
+            case PNM_OBJ_TEXT: {
+                anim->move.x_val = &obj->txt.center_x;
+                anim->move.y_val = &obj->txt.center_y;
+            } break;
+            case PNM_OBJ_GROUP: {
+                anim->move.x_val = &obj->grp.x;
+                anim->move.y_val = &obj->grp.y;
+            } break;
+            default: __debugbreak();
+        }
+    }
+}
+
+static inline void
+panim_camera_pan(PAnimScene * scene, int x, int y, bool relative_move,
+                 size_t begin_frame, size_t length)
+{
+    panim_scene_add_move(scene, &scene->camera.x, &scene->camera.y,
+                         x, y, relative_move, begin_frame, length);
+}
+
+static inline void
+panim_camera_zoom(PAnimScene * scene, float zoom,
+                  size_t begin_frame, size_t length)
+{
+    if (scene->camera.zoom == 0) scene->camera.zoom = 1;
+    panim_scene_add_tween(scene, &scene->camera.zoom, zoom, begin_frame, length);
+}
+
+static inline PAnimObject *
+panim_fade_in_image(PAnimScene * scene, SDL_Texture * texture,
+                    int depth_level, int center_x, int center_y,
+                    size_t begin_frame, size_t length)
+{
+    PAnimObject *img = panim_scene_add_image(
+        scene, texture, (SDL_Color){ 0xFF, 0xFF, 0xFF, 0 },
+        center_x, center_y, depth_level);
+    panim_scene_add_fade(
+        scene, img, (SDL_Color){ 0xFF, 0xFF, 0xFF, 0xFF },
+        begin_frame, length);
     return img;
 }
 
 static inline PAnimObject *
-panim_fade_in_text(PAnimScene * scene, char * text,
+panim_fade_in_text(PAnimScene * scene, const char * text,
                    TTF_Font * font, SDL_Color color,
                    int depth_level, int center_x, int center_y,
                    PAnimTextAlignment alignment,
@@ -329,11 +1255,64 @@ panim_draw_line(PAnimScene * scene, SDL_Color color,
     return line;
 }
 
+/*
+ * Builds a polyline out of `point_count - 1` line segments, put into a new
+ * group so it can be moved and faded as a whole. Round caps double as joins.
+ * Points are given as (x, y) pairs, relative to the group at (x, y).
+ */
+static PAnimObject *
+panim_draw_polyline(PAnimScene * scene, SDL_Color color,
+                    int depth_level, int x, int y,
+                    const SDL_Point * points, size_t point_count,
+                    float width, PAnimLineCap cap,
+                    size_t begin_frame, size_t length)
+{
+    PAnimObject *group = panim_scene_add_group(scene, NULL, x, y);
+    if (point_count < 2) return group;
+    
+    size_t segment_count = point_count - 1;
+    for (size_t i = 0; i < segment_count; ++i) {
+        // Segments are drawn one after the other over the given length
+        size_t seg_begin  = begin_frame + (length * i) / segment_count;
+        size_t seg_length = begin_frame + (length * (i + 1)) / segment_count - seg_begin;
+        
+        PAnimObject *line = panim_draw_line(
+            scene, color, depth_level,
+            points[i].x, points[i].y, points[i + 1].x, points[i + 1].y,
+            seg_begin, seg_length);
+        panim_line_set_style(line, width, (i == 0 || i + 1 == segment_count)
+                             ? cap : PNM_LINE_CAP_ROUND);
+        panim_object_set_parent(line, group, false);
+    }
+    
+    return group;
+}
+
+static inline void
+panim_move_group(PAnimScene * scene, PAnimObject * group,
+                 int x, int y, bool relative_move,
+                 size_t begin_frame, size_t length)
+{
+    assert(group->type == PNM_OBJ_GROUP);
+    panim_scene_add_move(
+        scene, &group->grp.x, &group->grp.y, x, y, relative_move, begin_frame, length);
+}
+
 static int
 panim_object_depth_sort(const PAnimObject ** a, const PAnimObject ** b)
 {
     if ((*a)->depth_level < (*b)->depth_level) return -1;
     if ((*a)->depth_level > (*b)->depth_level) return  1;
+    if ((*a)->order < (*b)->order) return -1;
+    if ((*a)->order > (*b)->order) return  1;
+    return 0;
+}
+
+static int
+panim_group_level_sort(const PAnimObject ** a, const PAnimObject ** b)
+{
+    if ((*a)->grp.level < (*b)->grp.level) return -1;
+    if ((*a)->grp.level > (*b)->grp.level) return  1;
     return 0;
 }
 
@@ -345,17 +1324,222 @@ panim_event_time_sort(const PAnimEvent * a, const PAnimEvent * b)
     return 0;
 }
 
+typedef struct {
+    PAnimObject * object;
+    size_t begin_frame;
+    size_t end_frame;
+    uint32_t order;
+    unsigned char alpha;
+} PAnimFadeSummary; // 32 bytes, as sorting millions of these is mostly copying
+
+static int
+panim_fade_summary_sort(const PAnimFadeSummary * a, const PAnimFadeSummary * b)
+{
+    if ((uintptr_t)a->object < (uintptr_t)b->object) return -1;
+    if ((uintptr_t)a->object > (uintptr_t)b->object) return  1;
+    if (a->order < b->order) return -1;
+    if (a->order > b->order) return  1;
+    return 0;
+}
+
+static int
+panim_frame_sort(const uint32_t * a, const uint32_t * b)
+{
+    if (*a < *b) return -1;
+    if (*a > *b) return  1;
+    return 0;
+}
+
+static int
+panim_lifetime_mark_sort(const PAnimLifetimeMark * a, const PAnimLifetimeMark * b)
+{
+    if (a->frame < b->frame) return -1;
+    if (a->frame > b->frame) return  1;
+    if (a->object < b->object) return -1;
+    if (a->object > b->object) return  1;
+    return 0;
+}
+
+/*
+ * Narrows down the lifetimes of objects that start out fully transparent,
+ * or end up that way after their last fade, so they never enter the draw
+ * list while they're invisible anyway. Expects a time-sorted timeline.
+ */
+static void
+panim_scene_infer_lifetimes(PAnimScene * scene)
+{
+    assert(buf_len(scene->timeline) <= UINT32_MAX);
+    PAnimFadeSummary *fades = NULL;
+    for (size_t i = 0; i < buf_len(scene->timeline); ++i) {
+        PAnimEvent *anim = scene->timeline + i;
+        if (anim->type != PNM_EVENT_COLOR_FADE) continue;
+        
+        buf_push(fades, (PAnimFadeSummary){
+            .object = anim->colfd.object,
+            .begin_frame = anim->begin_frame,
+            .end_frame = (size_t) anim->begin_frame + anim->length,
+            .order = (uint32_t) i,
+            .alpha = anim->colfd.new_color.a,
+        });
+    }
+    buf_sort(fades, panim_fade_summary_sort);
+    
+    for (size_t i = 0; i < buf_len(scene->objects); ++i) {
+        PAnimObject *obj = scene->objects[i];
+        if (obj->color.a != 0) continue;
+        
+        PAnimFadeSummary key = { .object = obj, .order = 0 };
+        size_t lo = 0, hi = buf_len(fades);
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (panim_fade_summary_sort(fades + mid, &key) < 0) lo = mid + 1;
+            else hi = mid;
+        }
+        
+        // Fades of the same object are ordered by begin frame,
+        // so the first one we find is the earliest
+        if (lo < buf_len(fades) && fades[lo].object == obj) {
+            obj->spawn_frame = MAX(obj->spawn_frame, fades[lo].begin_frame);
+        } else {
+            obj->spawn_frame = PNM_FRAME_NEVER;
+        }
+    }
+    
+    for (size_t first = 0; first < buf_len(fades);) {
+        PAnimObject *obj = fades[first].object;
+        size_t last = first;
+        while (last + 1 < buf_len(fades) && fades[last + 1].object == obj) ++last;
+        
+        // On ties, the fade ticked last in the frame determines the color
+        PAnimFadeSummary *final = fades + first;
+        for (size_t j = first + 1; j <= last; ++j) {
+            if (fades[j].end_frame >= final->end_frame) final = fades + j;
+        }
+        if (final->alpha == 0 && final->end_frame < obj->despawn_frame) {
+            obj->despawn_frame = final->end_frame;
+        }
+        
+        first = last + 1;
+    }
+    
+    buf_free(fades);
+}
+
+/*
+ * Brings cached world transforms up to date. Only groups that were moved or
+ * faded since the last update, and their descendants, are recomputed.
+ */
+static void
+panim_scene_update_transforms(PAnimScene * scene, bool force)
+{
+    for (size_t i = 0; i < buf_len(scene->groups); ++i) {
+        PAnimObject *group = scene->groups[i];
+        PAnimObject *parent = group->parent;
+        
+        bool dirty = force
+            || group->grp.x != group->grp.cached_x
+            || group->grp.y != group->grp.cached_y
+            || group->color.a != group->grp.cached_alpha
+            || (parent && parent->grp.changed);
+        
+        group->grp.changed = dirty;
+        if (!dirty) continue;
+        
+        group->grp.cached_x = group->grp.x;
+        group->grp.cached_y = group->grp.y;
+        group->grp.cached_alpha = group->color.a;
+        
+        if (parent) {
+            group->grp.world_x = parent->grp.world_x + group->grp.x;
+            group->grp.world_y = parent->grp.world_y + group->grp.y;
+            group->grp.world_alpha = (unsigned char)(
+                (parent->grp.world_alpha * group->color.a + 127) / 255);
+        } else {
+            group->grp.world_x = group->grp.x;
+            group->grp.world_y = group->grp.y;
+            group->grp.world_alpha = group->color.a;
+        }
+    }
+}
+
 static void
 panim_scene_finalize(PAnimScene * scene)
 {
+    // Compiled scenes were finalized before they were written
+    if (scene->file) return;
+    
+    if (scene->camera.zoom == 0) scene->camera.zoom = 1;
+    
     // This sort is why scene->objects needs to be an array of pointers.
     // If it were a flat array, any pointers to any of its elements would
     // be invalidated here.        (25 April 2018)
-    qsort(scene->objects, buf_len(scene->objects),
-          sizeof(PAnimObject *), panim_object_depth_sort);
+    buf_sort(scene->objects, panim_object_depth_sort);
+    
+    buf_sort(scene->timeline, panim_event_time_sort);
+    
+    // Parents need to have their world transforms updated before children
+    for (size_t i = 0; i < buf_len(scene->groups); ++i) {
+        PAnimObject *group = scene->groups[i];
+        group->grp.level = 0;
+        for (PAnimObject *p = group->parent; p; p = p->parent) {
+            group->grp.level += 1;
+        }
+    }
+    buf_sort(scene->groups, panim_group_level_sort);
+    panim_scene_update_transforms(scene, true);
+    
+    panim_scene_infer_lifetimes(scene);
+    
+    buf_clear(scene->spawn_order);
+    buf_clear(scene->despawn_order);
+    for (size_t i = 0; i < buf_len(scene->objects); ++i) {
+        PAnimObject *obj = scene->objects[i];
+        if (obj->spawn_frame >= obj->despawn_frame) continue;
+        assert(obj->spawn_frame < UINT32_MAX && i < UINT32_MAX);
+        
+        buf_push(scene->spawn_order, (PAnimLifetimeMark){ (uint32_t) obj->spawn_frame, (uint32_t) i });
+        if (obj->despawn_frame != PNM_FRAME_NEVER) {
+            uint32_t despawn_frame = (uint32_t) MIN(obj->despawn_frame, UINT32_MAX - 1);
+            buf_push(scene->despawn_order, (PAnimLifetimeMark){ despawn_frame, (uint32_t) i });
+        }
+    }
+    
+    buf_sort(scene->spawn_order, panim_lifetime_mark_sort);
+    buf_sort(scene->despawn_order, panim_lifetime_mark_sort);
+    
+    buf_clear(scene->live);
+    scene->live_frame = 0;
+    scene->next_spawn = 0;
+    scene->next_despawn = 0;
     
-    qsort(scene->timeline, buf_len(scene->timeline),
-          sizeof(PAnimEvent), panim_event_time_sort);
+    buf_clear(scene->active);
+    scene->next_event = 0;
+    
+    // An event reads the state it starts from in its first frame, which
+    // may depend on other events in the previous frame, and leaves its
+    // final state behind in its last frame. Everything in between can be
+    // skipped without changing the outcome.
+    buf_clear(scene->key_frames);
+    for (size_t i = 0; i < buf_len(scene->timeline); ++i) {
+        PAnimEvent *anim = scene->timeline + i;
+        if (i > 0 && anim->begin_frame == anim[-1].begin_frame && anim->length == anim[-1].length) {
+            continue; // Events added in bulk share their timing
+        }
+        if (anim->begin_frame > 0) buf_push(scene->key_frames, anim->begin_frame - 1);
+        buf_push(scene->key_frames, anim->begin_frame);
+        buf_push(scene->key_frames, anim->begin_frame + (uint32_t) anim->length);
+    }
+    buf_sort(scene->key_frames, panim_frame_sort);
+    
+    size_t unique_count = 0;
+    for (size_t i = 0; i < buf_len(scene->key_frames); ++i) {
+        if (unique_count == 0 || scene->key_frames[unique_count - 1] != scene->key_frames[i]) {
+            scene->key_frames[unique_count++] = scene->key_frames[i];
+        }
+    }
+    if (scene->key_frames) buf__hdr(scene->key_frames)->len = unique_count;
+    
+    scene->frame = PNM_FRAME_NEVER;
 }
 
 static inline int
@@ -382,31 +1566,34 @@ panim_lerp_color(SDL_Color a, SDL_Color b, float t)
 }
 
 static void
-panim_event_tick(PAnimEvent * anim, size_t t)
+panim_event_tick(const PAnimEvent * anim, PAnimActiveEvent * active, size_t t)
 {
     if (t < anim->begin_frame) return;
-    if (t > anim->begin_frame + anim->length) return;
+    if (t > (size_t) anim->begin_frame + anim->length) return;
     
     if (t == anim->begin_frame) {
         switch (anim->type) {
             case PNM_EVENT_COLOR_FADE: {
-                anim->colfd.old_color = *anim->colfd.value;
+                active->old.color = anim->colfd.object->color;
             } break;
             case PNM_EVENT_MOVEMENT: {
-                anim->move.x_old = *anim->move.x_val;
-                anim->move.y_old = *anim->move.y_val;
-                
-                if (anim->move.relative) {
-                    anim->move.x_target += anim->move.x_old;
-                    anim->move.y_target += anim->move.y_old;
-                }
+                active->old.pos.x = *anim->move.x_val;
+                active->old.pos.y = *anim->move.y_val;
+            } break;
+            case PNM_EVENT_TWEEN: {
+                active->old.value = *anim->tween.value;
             } break;
             case PNM_EVENT_COLOCATE: {
                 PAnimObject *src = anim->copy_pos.src;
                 PAnimObject *dst = anim->copy_pos.dst;
                 
-                int new_x = anim->copy_pos.x_offset;
-                int new_y = anim->copy_pos.y_offset;
+                // Positions are compared in world space, but written
+                // relative to the destination's parent group
+                int src_x, src_y; panim_group_origin(src->parent, &src_x, &src_y);
+                int dst_x, dst_y; panim_group_origin(dst->parent, &dst_x, &dst_y);
+                
+                int new_x = src_x;
+                int new_y = src_y;
                 if (src->type == PNM_OBJ_IMAGE) {
                     new_x += src->img.location.x + src->img.location.w / 2;
                     new_y += src->img.location.y + src->img.location.h / 2;
@@ -414,16 +1601,25 @@ panim_event_tick(PAnimEvent * anim, size_t t)
                     new_x += src->txt.center_x;
                     new_y += src->txt.center_y;
                 } else if (src->type == PNM_OBJ_LINE) {
-                    new_x += (src->line.x1 + src->line.x2) / 2;
-                    new_y += (src->line.y1 + src->line.y2) / 2;
+                    new_x = (2*src_x + src->line.x1 + src->line.x2) / 2;
+                    new_y = (2*src_y + src->line.y1 + src->line.y2) / 2;
+                } else if (src->type == PNM_OBJ_GROUP) {
+                    new_x += src->grp.x;
+                    new_y += src->grp.y;
                 }
                 
+                new_x += anim->copy_pos.x_offset - dst_x;
+                new_y += anim->copy_pos.y_offset - dst_y;
+                
                 if (dst->type == PNM_OBJ_IMAGE) {
                     dst->img.location.x = new_x - dst->img.location.w / 2;
                     dst->img.location.y = new_y - dst->img.location.h / 2;
                 } else if (dst->type == PNM_OBJ_TEXT) {
                     dst->txt.center_x = new_x;
                     dst->txt.center_y = new_y;
+                } else if (dst->type == PNM_OBJ_GROUP) {
+                    dst->grp.x = new_x;
+                    dst->grp.y = new_y;
                 } else if (dst->type == PNM_OBJ_LINE) {
                     // Unclear what this would even be used for...?
                     __debugbreak();
@@ -438,374 +1634,4572 @@ panim_event_tick(PAnimEvent * anim, size_t t)
     float completion = (float)(t - anim->begin_frame) / (float)(anim->length);
     switch (anim->type) {
         case PNM_EVENT_COLOR_FADE: {
-            *anim->colfd.value = panim_lerp_color(
-                anim->colfd.old_color, anim->colfd.new_color, completion);
+            anim->colfd.object->color = panim_lerp_color(
+                active->old.color, anim->colfd.new_color, completion);
         } break;
         case PNM_EVENT_MOVEMENT: {
             float smoothstep = completion * completion * (3 - 2 * completion);
             
-            *anim->move.x_val = panim_lerp_s32(
-                anim->move.x_old, anim->move.x_target, smoothstep);
-            *anim->move.y_val = panim_lerp_s32(
-                anim->move.y_old, anim->move.y_target, smoothstep);
+            // Relative targets are resolved here rather than at the start,
+            // so that replaying the event from scratch gives the same result
+            int x_target = anim->move.x_target;
+            int y_target = anim->move.y_target;
+            if (anim->relative) {
+                x_target += active->old.pos.x;
+                y_target += active->old.pos.y;
+            }
+            
+            *anim->move.x_val = panim_lerp_s32(active->old.pos.x, x_target, smoothstep);
+            *anim->move.y_val = panim_lerp_s32(active->old.pos.y, y_target, smoothstep);
+        } break;
+        case PNM_EVENT_TWEEN: {
+            float smoothstep = completion * completion * (3 - 2 * completion);
+            
+            *anim->tween.value = active->old.value +
+                smoothstep * (anim->tween.target - active->old.value);
         } break;
         default: __debugbreak();
     }
 }
 
-static void
-panim_object_draw(PAnimEngine * pnm, PAnimObject * obj)
+static inline SDL_Rect
+panim_text_location(PAnimObject * obj, int w, int h)
 {
-    switch (obj->type) {
+    SDL_Rect location = { .y = obj->txt.center_y - h/2, .w = w, .h = h };
+    switch (obj->txt.align) {
+        case PNM_TXT_ALIGN_LEFT:   location.x = obj->txt.center_x;       break;
+        case PNM_TXT_ALIGN_CENTER: location.x = obj->txt.center_x - w/2; break;
+        case PNM_TXT_ALIGN_RIGHT:  location.x = obj->txt.center_x - w;   break;
+    }
+    return location;
+}
+
+static inline void
+panim_text_measure(PAnimObject * obj)
+{
+    if (obj->txt.w == 0 && obj->txt.h == 0) {
+        TTF_SizeText(obj->txt.font, obj->txt.data, &obj->txt.w, &obj->txt.h);
+    }
+}
+
+static inline int
+panim_view_scale(int value, int center, float zoom)
+{
+    return (int)floorf((float)(value - center) * zoom + 0.5f) + center;
+}
+
+/*
+ * Returns a copy of `obj` with its position and alpha resolved against the
+ * cached world transform of its parent group, then transformed into screen
+ * space by the scene's camera.
+ */
+static PAnimObject
+panim_object_to_screen(PAnimScene * scene, PAnimObject * obj)
+{
+    if (obj->type == PNM_OBJ_TEXT) panim_text_measure(obj);
+    
+    PAnimObject result = *obj;
+    PAnimObject *parent = obj->parent;
+    if (parent) {
+        panim_object_translate(&result, parent->grp.world_x, parent->grp.world_y);
+        result.color.a = (unsigned char)(
+            (obj->color.a * parent->grp.world_alpha + 127) / 255);
+        result.parent = NULL;
+    }
+    
+    PAnimCamera cam = scene->camera;
+    panim_object_translate(&result, -cam.x, -cam.y);
+    if (cam.zoom == 1.0f) return result;
+    
+    int cx = scene->screen_width / 2;
+    int cy = scene->screen_height / 2;
+    switch (result.type) {
         case PNM_OBJ_IMAGE: {
-            SDL_SetTextureColorMod(obj->img.texture,
-                                   obj->color.r, obj->color.g, obj->color.b);
-            SDL_SetTextureAlphaMod(obj->img.texture, obj->color.a);
-            
-            int ret = SDL_RenderCopy(
-                pnm->renderer, obj->img.texture, NULL, &obj->img.location);
+            SDL_Rect *loc = &result.img.location;
+            int x2 = panim_view_scale(loc->x + loc->w, cx, cam.zoom);
+            int y2 = panim_view_scale(loc->y + loc->h, cy, cam.zoom);
+            loc->x = panim_view_scale(loc->x, cx, cam.zoom);
+            loc->y = panim_view_scale(loc->y, cy, cam.zoom);
+            loc->w = x2 - loc->x;
+            loc->h = y2 - loc->y;
         } break;
         case PNM_OBJ_TEXT: {
-            // TODO(Optimization): Only redraw text when necessary
-            SDL_Surface *surf = TTF_RenderText_Solid(
-                obj->txt.font, obj->txt.data, (SDL_Color){ 0xFF, 0xFF, 0xFF, 0xFF });
-            SDL_Texture *text = SDL_CreateTextureFromSurface(pnm->renderer, surf);
-            SDL_FreeSurface(surf);
-            
-            SDL_SetTextureBlendMode(text, SDL_BLENDMODE_BLEND);
-            SDL_SetTextureColorMod(text, obj->color.r, obj->color.g, obj->color.b);
-            SDL_SetTextureAlphaMod(text, obj->color.a);
-            
-            int w, h; SDL_QueryTexture(text, NULL, NULL, &w, &h);
-            SDL_Rect location;
-            switch (obj->txt.align) {
-                case PNM_TXT_ALIGN_LEFT:
-                location = (SDL_Rect){
-                    .x = obj->txt.center_x,
-                    .y = obj->txt.center_y - h/2,
-                    .w = w, .h = h,
-                }; break;
-                case PNM_TXT_ALIGN_CENTER:
-                location = (SDL_Rect){
-                    .x = obj->txt.center_x - w/2,
-                    .y = obj->txt.center_y - h/2,
-                    .w = w, .h = h,
-                }; break;
-                case PNM_TXT_ALIGN_RIGHT:
-                location = (SDL_Rect){
-                    .x = obj->txt.center_x - w,
-                    .y = obj->txt.center_y - h/2,
-                    .w = w, .h = h,
-                }; break;
-            }
-            
-            SDL_RenderCopy(pnm->renderer, text, NULL, &location);
+            result.txt.center_x = panim_view_scale(result.txt.center_x, cx, cam.zoom);
+            result.txt.center_y = panim_view_scale(result.txt.center_y, cy, cam.zoom);
+            result.txt.w = (int)((float)result.txt.w * cam.zoom + 0.5f);
+            result.txt.h = (int)((float)result.txt.h * cam.zoom + 0.5f);
         } break;
         case PNM_OBJ_LINE: {
-            SDL_SetRenderDrawBlendMode(pnm->renderer, SDL_BLENDMODE_BLEND);
-            SDL_SetRenderDrawColor(pnm->renderer,
-                                   obj->color.r,
-                                   obj->color.g,
-                                   obj->color.b,
-                                   obj->color.a);
-            SDL_RenderDrawLine(pnm->renderer,
-                               obj->line.x1, obj->line.y1,
-                               obj->line.x2, obj->line.y2);
+            result.line.x1 = panim_view_scale(result.line.x1, cx, cam.zoom);
+            result.line.y1 = panim_view_scale(result.line.y1, cy, cam.zoom);
+            result.line.x2 = panim_view_scale(result.line.x2, cx, cam.zoom);
+            result.line.y2 = panim_view_scale(result.line.y2, cy, cam.zoom);
+            result.line.width *= cam.zoom;
         } break;
         default: __debugbreak();
     }
+    
+    return result;
 }
 
-static PAnimEngine
-panim_engine_begin_preview(PAnimScene * scene)
+/*
+ * Returns the screen area covered by `obj` in its current state.
+ */
+static SDL_Rect
+panim_object_bounds(PAnimObject * obj)
 {
-    if (SDL_Init(SDL_INIT_EVERYTHING) != 0) ERROR("initialization failed (SDL)!");
-    if (TTF_Init() != 0) ERROR("initialization failed (TTF)!");
-    
-    PAnimEngine pnm = {0};
-    pnm.window = SDL_CreateWindow(
-        "PAnim",
-        SDL_WINDOWPOS_CENTERED,
-        SDL_WINDOWPOS_CENTERED,
-        scene->screen_width,
-        scene->screen_height, 0);
-    if (pnm.window == NULL) ERROR("failed to create window!");
+    switch (obj->type) {
+        case PNM_OBJ_IMAGE: {
+            return obj->img.location;
+        } break;
+        case PNM_OBJ_TEXT: {
+            panim_text_measure(obj);
+            return panim_text_location(obj, obj->txt.w, obj->txt.h);
+        } break;
+        case PNM_OBJ_LINE: {
+            // Conservative for any cap style, plus a pixel of anti-aliasing
+            int r = (int)ceilf(obj->line.width * 0.5f) + 1;
+            int x0 = obj->line.x1 < obj->line.x2 ? obj->line.x1 : obj->line.x2;
+            int y0 = obj->line.y1 < obj->line.y2 ? obj->line.y1 : obj->line.y2;
+            return (SDL_Rect){
+                .x = x0 - r, .y = y0 - r,
+                .w = abs(obj->line.x2 - obj->line.x1) + 2*r + 1,
+                .h = abs(obj->line.y2 - obj->line.y1) + 2*r + 1,
+            };
+        } break;
+        default: __debugbreak();
+    }
     
-    pnm.renderer = SDL_CreateRenderer(pnm.window, -1, SDL_RENDERER_ACCELERATED);
-    if (pnm.renderer == NULL) ERROR("failed to create renderer!");
+    return (SDL_Rect){0};
+}
+
+/*
+ * Culls objects that would not contribute any pixels to the current frame.
+ */
+static bool
+panim_object_visible(PAnimScene * scene, PAnimObject * obj)
+{
+    if (obj->color.a == 0) return false;
     
-    return pnm;
+    SDL_Rect bounds = panim_object_bounds(obj);
+    return bounds.x < scene->screen_width  && bounds.x + bounds.w > 0 &&
+           bounds.y < scene->screen_height && bounds.y + bounds.h > 0;
 }
 
+// Converts an ARGB8888 surface to premultiplied alpha, in place
 static void
-panim_engine_end_preview(PAnimEngine * pnm)
+panim_surface_premultiply(SDL_Surface * surface)
 {
-    SDL_DestroyRenderer(pnm->renderer);
-    SDL_DestroyWindow(pnm->window);
-    SDL_Quit();
+    for (int y = 0; y < surface->h; ++y) {
+        Uint32 *row = (Uint32 *)((char *)surface->pixels + y * surface->pitch);
+        for (int x = 0; x < surface->w; ++x) {
+            Uint32 p = row[x];
+            row[x] = panim_premultiply(p >> 24, (p >> 16) & 0xFF, (p >> 8) & 0xFF, p & 0xFF);
+        }
+    }
 }
 
-static void panim_scene_frame_update(PAnimScene * scene, size_t t);
-static void panim_scene_frame_render(PAnimEngine * pnm, PAnimScene * scene);
+// Hashes 32-bit pixels row by row, skipping any padding
+static uint64_t
+panim_pixels_hash(const void * pixels, int pitch, int width, int height)
+{
+    uint64_t h = ((uint64_t)(uint32_t)width << 32) | (uint32_t)height;
+    for (int y = 0; y < height; ++y) {
+        h = panim_hash64((const char *)pixels + y * pitch, width * sizeof(Uint32), h);
+    }
+    return h;
+}
 
-static AVFrame *
-panim_alloc_avframe(enum AVPixelFormat pix_fmt, int width, int height)
+static inline uint64_t
+panim_surface_hash(SDL_Surface * surface)
 {
-    AVFrame *result = av_frame_alloc();
-    if (!result) ERROR("failed to allocate an AVFrame!");
+    return panim_pixels_hash(surface->pixels, surface->pitch, surface->w, surface->h);
+}
+
+static char *
+panim_copy_string(const char * str)
+{
+    size_t size = strlen(str) + 1;
+    char *copy = (char *) malloc(size);
+    if (!copy) ERROR("out of memory!");
+    memcpy(copy, str, size);
+    return copy;
+}
+
+/*
+ * Loads an image from disk into a texture, keeping its pixels around for
+ * the CPU backend. Scenes should load their images through this rather
+ * than IMG_LoadTexture. Loading the same file again returns the same texture.
+ */
+static SDL_Texture *
+panim_engine_load_image(PAnimEngine * pnm, const char * filename)
+{
+    if (SDL_ThreadID() != pnm->main_thread) ERROR("images have to be loaded on the main thread!");
     
-    result->format = pix_fmt;
-    result->width  = width;
-    result->height = height;
+    for (size_t i = 0; i < buf_len(pnm->images); ++i) {
+        if (strcmp(pnm->images[i].filename, filename) == 0) return pnm->images[i].texture;
+    }
     
-    if (av_frame_get_buffer(result, 32) < 0) {
-        ERROR("failed to get frame buffer!");
+    SDL_Surface *loaded = IMG_Load(filename);
+    if (!loaded) ERROR("failed to load image!");
+    
+    PAnimImage image;
+    image.surface = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ARGB8888, 0);
+    SDL_FreeSurface(loaded);
+    if (!image.surface) ERROR("failed to convert image!");
+    
+    image.texture = SDL_CreateTextureFromSurface(pnm->renderer, image.surface);
+    if (!image.texture) ERROR("failed to create texture!");
+    panim_surface_premultiply(image.surface);
+    image.hash = panim_surface_hash(image.surface);
+    image.filename = panim_copy_string(filename);
+    
+    buf_push(pnm->images, image);
+    return image.texture;
+}
+
+/*
+ * Opens a font at the given point size, same as TTF_OpenFont, except that
+ * scenes need to load fonts through this to be compiled.
+ */
+static TTF_Font *
+panim_engine_load_font(PAnimEngine * pnm, const char * filename, int size)
+{
+    if (SDL_ThreadID() != pnm->main_thread) ERROR("fonts have to be loaded on the main thread!");
+    
+    for (size_t i = 0; i < buf_len(pnm->fonts); ++i) {
+        PAnimFont *f = pnm->fonts + i;
+        if (f->size == size && strcmp(f->filename, filename) == 0) return f->font;
     }
     
-    return result;
+    PAnimFont font;
+    font.font = TTF_OpenFont(filename, size);
+    if (!font.font) ERROR("failed to load font!");
+    font.filename = panim_copy_string(filename);
+    font.size = size;
+    
+    buf_push(pnm->fonts, font);
+    return font.font;
 }
 
-static inline void
-panim_frame_encode(AVCodecContext * cdc_ctx,
-                   AVFormatContext * fmt_ctx, AVStream * stream,
-                   AVFrame * frame, AVPacket * packet)
+static PAnimImage *
+panim_engine_image(PAnimEngine * pnm, SDL_Texture * texture)
 {
-    int ret = avcodec_send_frame(cdc_ctx, frame);
-    if (ret < 0) ERROR("failed to write frame!");
+    for (size_t i = 0; i < buf_len(pnm->images); ++i) {
+        if (pnm->images[i].texture == texture) return pnm->images + i;
+    }
     
-    while (ret >= 0) {
+    ERROR("image was not loaded with panim_engine_load_image!");
+    return NULL;
+}
+
+static inline SDL_Surface *
+panim_engine_image_surface(PAnimEngine * pnm, SDL_Texture * texture)
+{
+    return panim_engine_image(pnm, texture)->surface;
+}
+
+static SDL_Surface *
+panim_text_surface(PAnimObject * obj)
+{
+    if (!obj->txt.surface) {
+        SDL_Surface *surf = TTF_RenderText_Solid(
+            obj->txt.font, obj->txt.data, (SDL_Color){ 0xFF, 0xFF, 0xFF, 0xFF });
+        obj->txt.surface = SDL_ConvertSurfaceFormat(surf, SDL_PIXELFORMAT_ARGB8888, 0);
+        SDL_FreeSurface(surf);
+        if (!obj->txt.surface) ERROR("failed to convert text surface!");
+        panim_surface_premultiply(obj->txt.surface);
+    }
+    
+    return obj->txt.surface;
+}
+
+static SDL_Texture *
+panim_text_texture(PAnimEngine * pnm, PAnimObject * obj)
+{
+    if (!obj->txt.texture) {
+        // Rendered in white, the actual color is applied as a color mod
+        SDL_Surface *surf = TTF_RenderText_Solid(
+            obj->txt.font, obj->txt.data, (SDL_Color){ 0xFF, 0xFF, 0xFF, 0xFF });
+        obj->txt.texture = SDL_CreateTextureFromSurface(pnm->renderer, surf);
+        SDL_FreeSurface(surf);
+        
+        SDL_SetTextureBlendMode(obj->txt.texture, SDL_BLENDMODE_BLEND);
+    }
+    
+    return obj->txt.texture;
+}
+
+/*
+ * Coverage of a pixel whose center is `distance` away from the edge of a
+ * shape, positive inside; a one pixel wide linear ramp around the edge.
+ */
+static inline unsigned char
+panim_edge_coverage(float distance)
+{
+    float coverage = distance + 0.5f;
+    if (coverage <= 0.0f) return 0;
+    if (coverage >= 1.0f) return 0xFF;
+    return (unsigned char)(coverage * 255.0f + 0.5f);
+}
+
+static SDL_Texture *
+panim_coverage_texture(PAnimEngine * pnm, int w, int h, float radius, bool disc)
+{
+    SDL_Surface *surf = SDL_CreateRGBSurfaceWithFormat(
+        0, w, h, 32, SDL_PIXELFORMAT_ARGB8888);
+    if (!surf) ERROR("failed to allocate line texture!");
+    
+    for (int y = 0; y < h; ++y) {
+        Uint32 *row = (Uint32 *)((char *)surf->pixels + y * surf->pitch);
+        float dy = (float)y + 0.5f - (float)h * 0.5f;
+        for (int x = 0; x < w; ++x) {
+            float dx = (float)x + 0.5f - (float)w * 0.5f;
+            float dist = disc ? sqrtf(dx*dx + dy*dy) : fabsf(dy);
+            Uint32 alpha = panim_edge_coverage(radius - dist);
+            row[x] = (alpha << 24) | 0x00FFFFFF;
+        }
+    }
+    
+    // Line textures are stretched and rotated, so they need to be filtered
+    const char *quality = SDL_GetHint(SDL_HINT_RENDER_SCALE_QUALITY);
+    char old_quality[16] = "0";
+    if (quality) snprintf(old_quality, sizeof(old_quality), "%s", quality);
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1");
+    
+    SDL_Texture *result = SDL_CreateTextureFromSurface(pnm->renderer, surf);
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, old_quality);
+    SDL_FreeSurface(surf);
+    if (!result) ERROR("failed to create line texture!");
+    
+    SDL_SetTextureBlendMode(result, SDL_BLENDMODE_BLEND);
+    return result;
+}
+
+static PAnimLineTextures *
+panim_line_textures(PAnimEngine * pnm, float width)
+{
+    int width_key = (int)(width * 4.0f + 0.5f);
+    if (width_key < 1) width_key = 1;
+    
+    for (size_t i = 0; i < buf_len(pnm->line_textures); ++i) {
+        if (pnm->line_textures[i].width_key == width_key) {
+            return pnm->line_textures + i;
+        }
+    }
+    
+    float radius = (float)width_key / 8.0f;
+    PAnimLineTextures textures;
+    textures.width_key = width_key;
+    textures.strip_h = (int)ceilf(2.0f * radius) + 2;
+    textures.disc_d  = textures.strip_h;
+    textures.strip = panim_coverage_texture(pnm, 2, textures.strip_h, radius, false);
+    textures.disc  = panim_coverage_texture(
+        pnm, textures.disc_d, textures.disc_d, radius, true);
+    
+    buf_push(pnm->line_textures, textures);
+    return buf_end(pnm->line_textures) - 1;
+}
+
+static void
+panim_line_submit(PAnimEngine * pnm, PAnimDrawCmd * cmd)
+{
+    PAnimLineTextures *tex = panim_line_textures(pnm, cmd->line.width);
+    
+    float dx = (float)(cmd->line.x2 - cmd->line.x1);
+    float dy = (float)(cmd->line.y2 - cmd->line.y1);
+    float len = sqrtf(dx*dx + dy*dy);
+    if (cmd->line.cap == PNM_LINE_CAP_SQUARE) len += cmd->line.width;
+    
+    if (len >= 0.5f) {
+        float cx = 0.5f * (float)(cmd->line.x1 + cmd->line.x2);
+        float cy = 0.5f * (float)(cmd->line.y1 + cmd->line.y2);
+        SDL_Rect dst = {
+            .x = (int)floorf(cx - 0.5f*len + 0.5f),
+            .y = (int)floorf(cy - 0.5f*(float)tex->strip_h + 0.5f),
+            .w = (int)(len + 0.5f),
+            .h = tex->strip_h,
+        };
+        double angle = atan2((double)dy, (double)dx) * (180.0 / 3.14159265358979323846);
+        SDL_RenderCopyEx(pnm->renderer, tex->strip, NULL, &dst,
+                         angle, NULL, SDL_FLIP_NONE);
+    }
+    
+    if (cmd->line.cap == PNM_LINE_CAP_ROUND) {
+        // NOTE: Caps overlap the strip, so translucent lines get darker there
+        SDL_Color c = cmd->color;
+        SDL_SetTextureColorMod(tex->disc, c.r, c.g, c.b);
+        SDL_SetTextureAlphaMod(tex->disc, c.a);
+        
+        int d = tex->disc_d;
+        SDL_Rect cap1 = { cmd->line.x1 - d/2, cmd->line.y1 - d/2, d, d };
+        SDL_Rect cap2 = { cmd->line.x2 - d/2, cmd->line.y2 - d/2, d, d };
+        SDL_RenderCopy(pnm->renderer, tex->disc, NULL, &cap1);
+        if (len >= 0.5f) SDL_RenderCopy(pnm->renderer, tex->disc, NULL, &cap2);
+    }
+}
+
+/*
+ * Appends the draw call for `obj` to the engine's draw list. `src` is the
+ * object as stored in the scene, `obj` its screen-space copy.
+ */
+static void
+panim_object_emit(PAnimEngine * pnm, PAnimObject * src, PAnimObject * obj)
+{
+    PAnimDrawCmd cmd = {0};
+    cmd.type = obj->type;
+    cmd.depth_level = obj->depth_level;
+    cmd.order = obj->order;
+    cmd.blend = SDL_BLENDMODE_BLEND;
+    cmd.color = obj->color;
+    
+    switch (obj->type) {
+        case PNM_OBJ_IMAGE: {
+            cmd.texture = obj->img.texture;
+            cmd.dst = obj->img.location;
+            if (pnm->backend == PNM_BACKEND_CPU) {
+                cmd.surface = panim_engine_image_surface(pnm, cmd.texture);
+            }
+        } break;
+        case PNM_OBJ_TEXT: {
+            if (pnm->backend == PNM_BACKEND_CPU) {
+                cmd.surface = panim_text_surface(src);
+            } else {
+                cmd.texture = panim_text_texture(pnm, src);
+            }
+            // Measured beforehand, and already scaled by the camera's zoom
+            cmd.dst = panim_text_location(obj, obj->txt.w, obj->txt.h);
+        } break;
+        case PNM_OBJ_LINE: {
+            if (pnm->backend == PNM_BACKEND_SDL) {
+                cmd.texture = panim_line_textures(pnm, obj->line.width)->strip;
+            }
+            cmd.line.x1 = obj->line.x1; cmd.line.y1 = obj->line.y1;
+            cmd.line.x2 = obj->line.x2; cmd.line.y2 = obj->line.y2;
+            cmd.line.width = obj->line.width;
+            cmd.line.cap = obj->line.cap;
+        } break;
+        default: __debugbreak();
+    }
+    
+    buf_push(pnm->draw_list, cmd);
+}
+
+static inline bool
+panim_color_equal(SDL_Color a, SDL_Color b)
+{
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+static inline uint32_t
+panim_color_key(SDL_Color c)
+{
+    return ((uint32_t)c.r << 24) | ((uint32_t)c.g << 16) | ((uint32_t)c.b << 8) | c.a;
+}
+
+/*
+ * Orders by depth, then by creation within a depth level, the same way
+ * panim_scene_finalize orders the objects. Anything else, like texture
+ * addresses, would change between runs, and with them the stacking of
+ * overlapping objects.
+ */
+static int
+panim_draw_cmd_sort(const PAnimDrawCmd * a, const PAnimDrawCmd * b)
+{
+    if (a->depth_level < b->depth_level) return -1;
+    if (a->depth_level > b->depth_level) return  1;
+    if (a->order < b->order) return -1;
+    if (a->order > b->order) return  1;
+    return 0;
+}
+
+/*
+ * Submits the sorted draw list, setting texture and render state once per
+ * run of draw calls sharing a texture and blend mode, and color/alpha mods
+ * only when they actually change.
+ *
+ * NOTE: The SDL version we ship (2.0.8) has no way to submit vertex-colored
+ * geometry, so each quad is still its own SDL_RenderCopy. The batches are
+ * what a geometry-capable backend would submit in a single call.
+ */
+static void
+panim_draw_list_submit(PAnimEngine * pnm)
+{
+    pnm->batch_count = 0;
+    
+    PAnimDrawCmd *cmds = pnm->draw_list;
+    size_t count = buf_len(pnm->draw_list);
+    for (size_t first = 0; first < count;) {
+        size_t end = first + 1;
+        while (end < count &&
+               cmds[end].depth_level == cmds[first].depth_level &&
+               cmds[end].texture == cmds[first].texture &&
+               cmds[end].blend == cmds[first].blend) ++end;
+        
+        pnm->batch_count += 1;
+        SDL_Texture *texture = cmds[first].texture;
+        SDL_SetTextureBlendMode(texture, cmds[first].blend);
+        
+        for (size_t i = first; i < end; ++i) {
+            SDL_Color c = cmds[i].color;
+            bool color_changed = (i == first) || !panim_color_equal(c, cmds[i - 1].color);
+            
+            if (color_changed) {
+                SDL_SetTextureColorMod(texture, c.r, c.g, c.b);
+                SDL_SetTextureAlphaMod(texture, c.a);
+            }
+            
+            if (cmds[i].type == PNM_OBJ_LINE) {
+                panim_line_submit(pnm, cmds + i);
+            } else {
+                SDL_RenderCopy(pnm->renderer, texture, NULL, &cmds[i].dst);
+            }
+        }
+        
+        first = end;
+    }
+}
+
+//
+// CPU Backend
+//
+
+static void
+panim_pool_work(PAnimThreadPool * pool)
+{
+    for (;;) {
+        int index = SDL_AtomicAdd(&pool->next_index, 1);
+        if (index >= pool->job_count) break;
+        pool->job(pool->job_data, index);
+    }
+}
+
+static int
+panim_pool_worker(void * data)
+{
+    PAnimThreadPool *pool = (PAnimThreadPool *) data;
+    for (;;) {
+        SDL_SemWait(pool->start);
+        if (pool->quit) break;
+        
+        panim_pool_work(pool);
+        SDL_SemPost(pool->done);
+    }
+    
+    return 0;
+}
+
+/*
+ * Spawns `thread_count - 1` workers; `pool` must not move afterwards.
+ */
+static void
+panim_pool_init(PAnimThreadPool * pool, int thread_count)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->start = SDL_CreateSemaphore(0);
+    pool->done  = SDL_CreateSemaphore(0);
+    if (!pool->start || !pool->done) ERROR("failed to create semaphores!");
+    
+    pool->thread_count = thread_count > 1 ? thread_count - 1 : 0;
+    pool->threads = (SDL_Thread **) calloc(pool->thread_count + 1, sizeof(SDL_Thread *));
+    for (int i = 0; i < pool->thread_count; ++i) {
+        pool->threads[i] = SDL_CreateThread(panim_pool_worker, "PAnim Worker", pool);
+        if (!pool->threads[i]) ERROR("failed to create worker thread!");
+    }
+}
+
+static void
+panim_pool_run(PAnimThreadPool * pool, PAnimJobFunc * job, void * data, int job_count)
+{
+    pool->job = job;
+    pool->job_data = data;
+    pool->job_count = job_count;
+    SDL_AtomicSet(&pool->next_index, 0);
+    
+    for (int i = 0; i < pool->thread_count; ++i) SDL_SemPost(pool->start);
+    panim_pool_work(pool);
+    for (int i = 0; i < pool->thread_count; ++i) SDL_SemWait(pool->done);
+}
+
+static void
+panim_pool_destroy(PAnimThreadPool * pool)
+{
+    pool->quit = true;
+    for (int i = 0; i < pool->thread_count; ++i) SDL_SemPost(pool->start);
+    for (int i = 0; i < pool->thread_count; ++i) SDL_WaitThread(pool->threads[i], NULL);
+    
+    free(pool->threads);
+    SDL_DestroySemaphore(pool->start);
+    SDL_DestroySemaphore(pool->done);
+}
+
+static inline bool
+panim_rect_clip(SDL_Rect * rect, SDL_Rect clip)
+{
+    int x0 = MAX(rect->x, clip.x);
+    int y0 = MAX(rect->y, clip.y);
+    int x1 = rect->x + rect->w < clip.x + clip.w ? rect->x + rect->w : clip.x + clip.w;
+    int y1 = rect->y + rect->h < clip.y + clip.h ? rect->y + rect->h : clip.y + clip.h;
+    *rect = (SDL_Rect){ x0, y0, x1 - x0, y1 - y0 };
+    return x0 < x1 && y0 < y1;
+}
+
+static SDL_Rect
+panim_draw_cmd_bounds(PAnimDrawCmd * cmd)
+{
+    if (cmd->type != PNM_OBJ_LINE) return cmd->dst;
+    
+    int r = (int)ceilf(cmd->line.width * 0.5f) + 1;
+    int x0 = cmd->line.x1 < cmd->line.x2 ? cmd->line.x1 : cmd->line.x2;
+    int y0 = cmd->line.y1 < cmd->line.y2 ? cmd->line.y1 : cmd->line.y2;
+    return (SDL_Rect){
+        .x = x0 - r, .y = y0 - r,
+        .w = abs(cmd->line.x2 - cmd->line.x1) + 2*r + 1,
+        .h = abs(cmd->line.y2 - cmd->line.y1) + 2*r + 1,
+    };
+}
+
+/*
+ * Nearest-neighbor scaled copy with color modulation, as SDL_RenderCopy.
+ */
+static void
+panim_raster_sprite(PAnimRaster * ras, PAnimDrawCmd * cmd, SDL_Rect clip)
+{
+    SDL_Surface *src = cmd->surface;
+    SDL_Rect dst = cmd->dst;
+    SDL_Rect area = dst;
+    if (dst.w <= 0 || dst.h <= 0 || !panim_rect_clip(&area, clip)) return;
+    
+    SDL_Color c = cmd->color;
+    uint32_t color = panim_premultiply(c.a, c.r, c.g, c.b);
+    
+    uint32_t row[PNM_TILE_SIZE];
+    for (int y = area.y; y < area.y + area.h; ++y) {
+        int sy = (int)(((int64_t)(2*(y - dst.y) + 1) * src->h) / (2*dst.h));
+        Uint32 *src_row = (Uint32 *)((char *)src->pixels + sy * src->pitch);
+        
+        for (int x = area.x; x < area.x + area.w; ++x) {
+            int sx = (int)(((int64_t)(2*(x - dst.x) + 1) * src->w) / (2*dst.w));
+            row[x - area.x] = src_row[sx];
+        }
+        
+        Uint32 *dst_row = ras->pixels + y * ras->width + area.x;
+        ras->kernels->modulate(row, row, area.w, color);
+        ras->kernels->blend(dst_row, row, area.w);
+    }
+}
+
+/*
+ * Anti-aliased line with the same one pixel coverage ramp as the
+ * textures used by the SDL backend, computed from the exact distance
+ * to the line's outline instead.
+ */
+static void
+panim_raster_line(PAnimRaster * ras, PAnimDrawCmd * cmd, SDL_Rect clip)
+{
+    SDL_Rect area = panim_draw_cmd_bounds(cmd);
+    if (!panim_rect_clip(&area, clip)) return;
+    
+    // End points are taken to be pixel centers
+    float ax = (float)cmd->line.x1 + 0.5f, ay = (float)cmd->line.y1 + 0.5f;
+    float dx = (float)(cmd->line.x2 - cmd->line.x1);
+    float dy = (float)(cmd->line.y2 - cmd->line.y1);
+    float len = sqrtf(dx*dx + dy*dy);
+    float ux = len > 0 ? dx / len : 1.0f;
+    float uy = len > 0 ? dy / len : 0.0f;
+    float r = cmd->line.width * 0.5f;
+    float ext = (cmd->line.cap == PNM_LINE_CAP_SQUARE) ? r : 0.0f;
+    
+    SDL_Color c = cmd->color;
+    
+    uint32_t row[PNM_TILE_SIZE];
+    for (int y = area.y; y < area.y + area.h; ++y) {
+        float py = (float)y + 0.5f - ay;
+        
+        for (int x = area.x; x < area.x + area.w; ++x) {
+            float px = (float)x + 0.5f - ax;
+            float along = px * ux + py * uy;
+            
+            float dist;
+            if (cmd->line.cap == PNM_LINE_CAP_ROUND) {
+                float t = along < 0 ? 0 : (along > len ? len : along);
+                float ox = px - t * ux, oy = py - t * uy;
+                dist = sqrtf(ox*ox + oy*oy) - r;
+            } else {
+                float perp = fabsf(px * uy - py * ux) - r;
+                float ends = MAX(-ext - along, along - len - ext);
+                dist = MAX(perp, ends);
+            }
+            
+            uint32_t a = panim_div255(panim_edge_coverage(-dist) * c.a);
+            row[x - area.x] = panim_premultiply(a, c.r, c.g, c.b);
+        }
+        
+        ras->kernels->blend(ras->pixels + y * ras->width + area.x, row, area.w);
+    }
+}
+
+static void
+panim_raster_tile(void * data, int index)
+{
+    PAnimRaster *ras = (PAnimRaster *) data;
+    int tx = index % ras->tiles_x;
+    int ty = index / ras->tiles_x;
+    
+    SDL_Rect clip = { tx * PNM_TILE_SIZE, ty * PNM_TILE_SIZE, PNM_TILE_SIZE, PNM_TILE_SIZE };
+    panim_rect_clip(&clip, (SDL_Rect){ 0, 0, ras->width, ras->height });
+    
+    SDL_Color bg = ras->bg_color;
+    uint32_t bg_pixel = panim_premultiply(bg.a, bg.r, bg.g, bg.b);
+    for (int y = clip.y; y < clip.y + clip.h; ++y) {
+        ras->kernels->fill(ras->pixels + y * ras->width + clip.x, clip.w, bg_pixel);
+    }
+    
+    uint32_t *cmds = ras->tile_cmds[index];
+    for (size_t i = 0; i < buf_len(cmds); ++i) {
+        PAnimDrawCmd *cmd = ras->cmds + cmds[i];
+        if (cmd->type == PNM_OBJ_LINE) {
+            panim_raster_line(ras, cmd, clip);
+        } else {
+            panim_raster_sprite(ras, cmd, clip);
+        }
+    }
+}
+
+static PAnimRaster *
+panim_raster_create(int width, int height, int thread_count)
+{
+    PAnimRaster *ras = (PAnimRaster *) calloc(1, sizeof(PAnimRaster));
+    ras->width  = width;
+    ras->height = height;
+    ras->kernels = panim_kernels_select();
+    ras->pixels = (Uint32 *) malloc((size_t)width * height * sizeof(Uint32));
+    if (!ras->pixels) ERROR("failed to allocate frame buffer!");
+    
+    ras->tiles_x = (width  + PNM_TILE_SIZE - 1) / PNM_TILE_SIZE;
+    ras->tiles_y = (height + PNM_TILE_SIZE - 1) / PNM_TILE_SIZE;
+    ras->tile_cmds = (uint32_t **) calloc(ras->tiles_x * ras->tiles_y, sizeof(uint32_t *));
+    
+    panim_pool_init(&ras->pool, thread_count);
+    return ras;
+}
+
+/*
+ * Bins the sorted draw list into screen tiles, then rasterizes all tiles
+ * in parallel. Each tile applies its draw calls in draw list order, so
+ * the result does not depend on the number of threads.
+ */
+static void
+panim_raster_render(PAnimRaster * ras, PAnimDrawCmd * cmds, SDL_Color bg_color)
+{
+    int tile_count = ras->tiles_x * ras->tiles_y;
+    for (int i = 0; i < tile_count; ++i) buf_clear(ras->tile_cmds[i]);
+    
+    SDL_Rect screen = { 0, 0, ras->width, ras->height };
+    for (size_t i = 0; i < buf_len(cmds); ++i) {
+        SDL_Rect bounds = panim_draw_cmd_bounds(cmds + i);
+        if (!panim_rect_clip(&bounds, screen)) continue;
+        
+        int tx0 = bounds.x / PNM_TILE_SIZE, tx1 = (bounds.x + bounds.w - 1) / PNM_TILE_SIZE;
+        int ty0 = bounds.y / PNM_TILE_SIZE, ty1 = (bounds.y + bounds.h - 1) / PNM_TILE_SIZE;
+        for (int ty = ty0; ty <= ty1; ++ty) {
+            for (int tx = tx0; tx <= tx1; ++tx) {
+                buf_push(ras->tile_cmds[ty * ras->tiles_x + tx], (uint32_t)i);
+            }
+        }
+    }
+    
+    ras->cmds = cmds;
+    ras->bg_color = bg_color;
+    panim_pool_run(&ras->pool, panim_raster_tile, ras, tile_count);
+}
+
+static void
+panim_raster_destroy(PAnimRaster * ras)
+{
+    panim_pool_destroy(&ras->pool);
+    for (int i = 0; i < ras->tiles_x * ras->tiles_y; ++i) buf_free(ras->tile_cmds[i]);
+    free(ras->tile_cmds);
+    free(ras->pixels);
+    if (ras->present) SDL_DestroyTexture(ras->present);
+    free(ras);
+}
+
+/*
+ * Sets up the engine for the given scene. The backend is selected by the
+ * PANIM_BACKEND environment variable ("sdl", the default, or "cpu"), the
+ * number of threads used by the CPU backend by PANIM_THREADS (defaults to
+ * the number of cores), and how many megabytes of rendered text each scene
+ * may keep by PANIM_TEXT_MB (defaults to 256). Without a display, the CPU
+ * backend runs headless, which is enough to render to a file.
+ */
+// Number of threads for the CPU backend to rasterize with
+static int
+panim_thread_count(void)
+{
+    const char *threads = SDL_getenv("PANIM_THREADS");
+    if (threads && atoi(threads) > 0) return atoi(threads);
+    return SDL_GetCPUCount();
+}
+
+static PAnimEngine
+panim_engine_begin_preview(PAnimScene * scene)
+{
+    PAnimEngine pnm = {0};
+    pnm.main_thread = SDL_ThreadID();
+    
+    const char *backend = SDL_getenv("PANIM_BACKEND");
+    if (backend && strcmp(backend, "cpu") == 0) pnm.backend = PNM_BACKEND_CPU;
+    
+    size_t text_mb = 256;
+    const char *text_budget = SDL_getenv("PANIM_TEXT_MB");
+    if (text_budget && atoi(text_budget) > 0) text_mb = (size_t) atoi(text_budget);
+    pnm.text_budget = text_mb * 1024 * 1024;
+    
+    bool headless = false;
+    if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
+        if (pnm.backend != PNM_BACKEND_CPU) ERROR("initialization failed (SDL)!");
+        if (SDL_Init(SDL_INIT_TIMER) != 0) ERROR("initialization failed (SDL)!");
+        headless = true;
+    }
+    if (TTF_Init() != 0) ERROR("initialization failed (TTF)!");
+    
+    if (!headless) {
+        pnm.window = SDL_CreateWindow(
+            "PAnim",
+            SDL_WINDOWPOS_CENTERED,
+            SDL_WINDOWPOS_CENTERED,
+            scene->screen_width,
+            scene->screen_height, 0);
+        if (pnm.window == NULL) ERROR("failed to create window!");
+    }
+    
+    if (pnm.backend == PNM_BACKEND_SDL) {
+        pnm.renderer = SDL_CreateRenderer(pnm.window, -1, SDL_RENDERER_ACCELERATED);
+        if (pnm.renderer == NULL) ERROR("failed to create renderer!");
+    } else {
+        pnm.raster = panim_raster_create(
+            scene->screen_width, scene->screen_height, panim_thread_count());
+        
+        if (pnm.window) {
+            // Any renderer will do, it only ever copies a single texture
+            pnm.renderer = SDL_CreateRenderer(pnm.window, -1, 0);
+            if (pnm.renderer == NULL) ERROR("failed to create renderer!");
+            
+            pnm.raster->present = SDL_CreateTexture(
+                pnm.renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                scene->screen_width, scene->screen_height);
+            if (!pnm.raster->present) ERROR("failed to create texture!");
+        } else {
+            // Textures are still handed out to scenes as image handles
+            SDL_Surface *dummy = SDL_CreateRGBSurfaceWithFormat(
+                0, 1, 1, 32, SDL_PIXELFORMAT_ARGB8888);
+            pnm.renderer = SDL_CreateSoftwareRenderer(dummy);
+            if (pnm.renderer == NULL) ERROR("failed to create renderer!");
+        }
+    }
+    
+    return pnm;
+}
+
+/*
+ * Frees everything the engine loaded or created, and shuts SDL down, so
+ * many scenes can be rendered one after another in the same process. Text
+ * textures belong to the renderer, so scenes have to be destroyed first.
+ */
+static void
+panim_engine_end_preview(PAnimEngine * pnm)
+{
+    for (size_t i = 0; i < buf_len(pnm->images); ++i) {
+        SDL_DestroyTexture(pnm->images[i].texture);
+        SDL_FreeSurface(pnm->images[i].surface);
+        free(pnm->images[i].filename);
+    }
+    for (size_t i = 0; i < buf_len(pnm->fonts); ++i) {
+        TTF_CloseFont(pnm->fonts[i].font);
+        free(pnm->fonts[i].filename);
+    }
+    for (size_t i = 0; i < buf_len(pnm->line_textures); ++i) {
+        SDL_DestroyTexture(pnm->line_textures[i].strip);
+        SDL_DestroyTexture(pnm->line_textures[i].disc);
+    }
+    buf_free(pnm->images);
+    buf_free(pnm->fonts);
+    buf_free(pnm->line_textures);
+    buf_free(pnm->draw_list);
+    
+    if (pnm->raster) panim_raster_destroy(pnm->raster);
+    SDL_DestroyRenderer(pnm->renderer);
+    if (pnm->window) SDL_DestroyWindow(pnm->window);
+    TTF_Quit();
+    SDL_Quit();
+    memset(pnm, 0, sizeof(PAnimEngine));
+}
+
+static void
+panim_engine_set_title(PAnimEngine * pnm, const char * title)
+{
+    if (pnm->window) SDL_SetWindowTitle(pnm->window, title);
+}
+
+/*
+ * Shows the most recently rendered frame in the preview window.
+ */
+static void
+panim_engine_present(PAnimEngine * pnm)
+{
+    if (pnm->backend == PNM_BACKEND_CPU) {
+        if (!pnm->window) return;
+        
+        PAnimRaster *ras = pnm->raster;
+        SDL_UpdateTexture(ras->present, NULL, ras->pixels, ras->width * sizeof(Uint32));
+        SDL_RenderCopy(pnm->renderer, ras->present, NULL, NULL);
+    }
+    
+    SDL_RenderPresent(pnm->renderer);
+}
+
+/*
+ * Copies the most recently rendered frame as ARGB8888 into `pixels`.
+ */
+static void
+panim_engine_read_pixels(PAnimEngine * pnm, void * pixels, int pitch)
+{
+    if (pnm->backend == PNM_BACKEND_CPU) {
+        PAnimRaster *ras = pnm->raster;
+        for (int y = 0; y < ras->height; ++y) {
+            ras->kernels->copy((uint32_t *)((char *)pixels + y * pitch),
+                               ras->pixels + y * ras->width, ras->width);
+        }
+    } else {
+        SDL_RenderReadPixels(pnm->renderer, NULL, SDL_PIXELFORMAT_ARGB8888, pixels, pitch);
+    }
+}
+
+static void panim_scene_frame_update(PAnimScene * scene, size_t t);
+static void panim_scene_frame_render(PAnimEngine * pnm, PAnimScene * scene);
+static void panim_scene_seek(PAnimScene * scene, size_t t);
+static void panim_scene_retire(PAnimScene * scene, bool free_text);
+static void panim_scene_destroy(PAnimScene * scene);
+
+// YouTube recommends GOP of half the frame rate,
+// i.e. at most one intra frame every thirty frames
+#define PNM_GOP_SIZE 30
+
+// Frames between two calls to panim_scene_retire during renders
+#define PNM_RETIRE_INTERVAL 600
+
+static AVFrame *
+panim_alloc_avframe(enum AVPixelFormat pix_fmt, int width, int height)
+{
+    AVFrame *result = av_frame_alloc();
+    if (!result) ERROR("failed to allocate an AVFrame!");
+    
+    result->format = pix_fmt;
+    result->width  = width;
+    result->height = height;
+    
+    if (av_frame_get_buffer(result, 32) < 0) {
+        ERROR("failed to get frame buffer!");
+    }
+    
+    return result;
+}
+
+/*
+ * Output file of an encoder. A render resuming an interrupted one writes
+ * a new header, which is dropped since the file already has one, and
+ * continues right after the last complete fragment.
+ */
+typedef struct {
+    FILE * file;
+    int64_t skip;     // number of bytes dropped at the start of the stream
+    int64_t base;     // file offset the first byte after those goes to
+    int64_t pos;      // position in the stream
+    int64_t file_pos; // position in the file
+} PAnimOutput;
+
+static int
+panim_output_write(void * opaque, uint8_t * data, int size)
+{
+    PAnimOutput *out = (PAnimOutput *) opaque;
+    int64_t begin = out->pos;
+    out->pos += size;
+    if (out->pos <= out->skip) return size;
+    
+    if (begin < out->skip) {
+        data += out->skip - begin;
+        begin = out->skip;
+    }
+    
+    int64_t offset = out->base + (begin - out->skip);
+    if (offset != out->file_pos && PNM_FSEEK(out->file, offset, SEEK_SET) != 0) {
+        return AVERROR(EIO);
+    }
+    
+    size_t count = (size_t)(out->pos - begin);
+    if (fwrite(data, 1, count, out->file) != count) return AVERROR(EIO);
+    out->file_pos = offset + count;
+    return size;
+}
+
+static int64_t
+panim_output_seek(void * opaque, int64_t offset, int whence)
+{
+    PAnimOutput *out = (PAnimOutput *) opaque;
+    switch (whence & ~AVSEEK_FORCE) {
+        case SEEK_SET: out->pos = offset; break;
+        case SEEK_CUR: out->pos += offset; break;
+        default: return -1;
+    }
+    return out->pos;
+}
+
+typedef struct {
+    AVFormatContext * fmt_ctx;
+    AVStream * stream;
+    AVCodecContext * cdc_ctx;
+    AVPacket * packet;
+    
+    PAnimOutput output;
+    AVIOContext * io;
+    
+    // Each line records the number of complete fragments, and the frame
+    // and file size they end at
+    FILE * journal;
+    char journal_name[1024];
+    size_t fragments;
+    
+    size_t from; // the frame encoded with pts 0
+    size_t packets_since_flush;
+} PAnimEncoder;
+
+/*
+ * Writes out everything before the key frame starting at `frame` as a
+ * fragment, then notes in the journal that it's safe to resume from there.
+ */
+static void
+panim_encoder_checkpoint(PAnimEncoder * enc, size_t frame)
+{
+    // With frag_custom, a NULL packet flushes the current fragment
+    if (av_write_frame(enc->fmt_ctx, NULL) < 0) ERROR("failed to write fragment!");
+    avio_flush(enc->fmt_ctx->pb);
+    if (fflush(enc->output.file) != 0) ERROR("failed to write fragment!");
+    
+    enc->fragments += 1;
+    fprintf(enc->journal, "%zu %zu %lld\n",
+            enc->fragments, frame, (long long) enc->output.file_pos);
+    fflush(enc->journal);
+    enc->packets_since_flush = 0;
+}
+
+static inline void
+panim_frame_encode(PAnimEncoder * enc, AVFrame * frame)
+{
+    AVCodecContext *cdc_ctx = enc->cdc_ctx;
+    AVStream *stream = enc->stream;
+    AVPacket *packet = enc->packet;
+    
+    int ret = avcodec_send_frame(cdc_ctx, frame);
+    if (ret < 0) ERROR("failed to write frame!");
+    
+    while (ret >= 0) {
         ret = avcodec_receive_packet(cdc_ctx, packet);
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
             break;
-        } else if (ret < 0) ERROR("error during encoding!");
+        } else if (ret < 0) ERROR("error during encoding!");
+        
+        // GOPs are closed, so every frame before a key frame has been
+        // written by the time it comes out of the encoder
+        if ((packet->flags & AV_PKT_FLAG_KEY) && enc->packets_since_flush > 0) {
+            panim_encoder_checkpoint(enc, enc->from + (size_t) packet->pts);
+        }
+        
+        packet->stream_index = stream->index;
+        if (packet->pts != AV_NOPTS_VALUE)
+            packet->pts = av_rescale_q(packet->pts, cdc_ctx->time_base, stream->time_base);
+        if (packet->dts != AV_NOPTS_VALUE)
+            packet->dts = av_rescale_q(packet->dts, cdc_ctx->time_base, stream->time_base);
+        
+        if (av_write_frame(enc->fmt_ctx, packet) < 0) {
+            ERROR("failed to write frame to stream");
+        }
+        
+        enc->packets_since_flush += 1;
+        av_packet_unref(packet);
+    }
+}
+
+/*
+ * Reads the journal left behind by an interrupted render of the same frame
+ * range, if any. Returns the number of complete fragments, and the frame
+ * and file size they end at. A line cut short by a crash is ignored.
+ */
+static size_t
+panim_journal_read(PAnimEncoder * enc, PAnimScene * scene, size_t to,
+                   size_t * frame, int64_t * bytes, int64_t * header_bytes)
+{
+    FILE *journal = fopen(enc->journal_name, "r");
+    if (!journal) return 0;
+    
+    size_t fragments = 0;
+    char line[256];
+    unsigned long long a, b, c, d;
+    if (fgets(line, sizeof(line), journal) &&
+        sscanf(line, "panim journal %llu %llu %llu %llu", &a, &b, &c, &d) == 4 &&
+        a == scene->length_in_frames && b == enc->from && c == to)
+    {
+        *header_bytes = (int64_t) d;
+        while (fgets(line, sizeof(line), journal) && strchr(line, '\n') &&
+               sscanf(line, "%llu %llu %llu", &a, &b, &c) == 3)
+        {
+            fragments = (size_t) a;
+            *frame = (size_t) b;
+            *bytes = (int64_t) c;
+        }
+    }
+    
+    fclose(journal);
+    return fragments;
+}
+
+/*
+ * Opens `filename` for writing an H.264 stream of the frames [from, to) of
+ * the scene, which are passed in as YUV420P. The output is a fragmented
+ * MP4, with one fragment per GOP, so it's playable while still being
+ * written. If a journal shows that a previous render of the same frames
+ * was interrupted, its complete fragments are kept. Returns the frame to
+ * continue rendering at.
+ */
+static size_t
+panim_encoder_open(PAnimEncoder * enc, PAnimScene * scene, char * filename,
+                   size_t from, size_t to)
+{
+    memset(enc, 0, sizeof(*enc));
+    enc->from = from;
+    snprintf(enc->journal_name, sizeof(enc->journal_name), "%s.journal", filename);
+    
+    size_t resume_frame = from;
+    int64_t resume_bytes = 0;
+    int64_t header_bytes = 0;
+    size_t fragments = panim_journal_read(
+        enc, scene, to, &resume_frame, &resume_bytes, &header_bytes);
+    
+    if (fragments > 0) {
+        enc->output.file = fopen(filename, "r+b");
+        if (enc->output.file && PNM_FSEEK(enc->output.file, 0, SEEK_END) == 0 &&
+            PNM_FTELL(enc->output.file) >= resume_bytes)
+        {
+            enc->output.skip = header_bytes;
+            enc->output.base = resume_bytes;
+            enc->output.file_pos = -1;
+        } else {
+            if (enc->output.file) fclose(enc->output.file);
+            enc->output.file = NULL;
+            fragments = 0;
+        }
+    }
+    if (fragments == 0) {
+        resume_frame = from;
+        enc->output.file = fopen(filename, "wb");
+        if (!enc->output.file) ERROR("failed to open output file!");
+    }
+    
+    av_register_all();
+    avcodec_register_all();
+    
+    AVFormatContext *fmt_ctx = NULL;
+    avformat_alloc_output_context2(&fmt_ctx, NULL, "mp4", filename);
+    if (!fmt_ctx) ERROR("failed to allocate an AVFormatContext");
+    
+    AVOutputFormat *fmt = fmt_ctx->oformat;
+    fmt->video_codec = AV_CODEC_ID_H264;
+    fmt->audio_codec = AV_CODEC_ID_NONE;
+    
+    AVCodec *codec = avcodec_find_encoder(fmt->video_codec);
+    if (!codec) ERROR("codec not found!");
+    
+    AVStream *stream = avformat_new_stream(fmt_ctx, codec);
+    if (!stream) ERROR("failed to add video stream to container!");
+    stream->id = fmt_ctx->nb_streams - 1;
+    
+    AVCodecContext *cdc_ctx = stream->codec;
+    { // Set codec parameters:
+        // TODO: specifying codec parameters like this is deprecated,
+        // you're supposed to use stream->codecpar, apparently, but I don't see
+        // how you'd specify most of these on that
+        
+        // TODO: codec-specific options (lossless?, CABAC?)
+        // I think you need to pass an AVOptions thing as the 3rd arg to
+        // avcodec_open2, but I can't seem to find out how to actually make one?
+        
+        cdc_ctx->width  = scene->screen_width;
+        cdc_ctx->height = scene->screen_height;
+        
+        // I don't know why you're supposed to do this, since avformat_write_header
+        // overwrites it with some ridiculous value later on, which is why we need
+        // to rescale our packets' timestamps in the main loop.
+        stream->time_base = (AVRational){1, 60};
+        
+        cdc_ctx->time_base = (AVRational){1, 60};
+        cdc_ctx->framerate = (AVRational){60, 1};
+        
+        cdc_ctx->gop_size = PNM_GOP_SIZE;
+        cdc_ctx->max_b_frames = 2;
+        cdc_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+        cdc_ctx->bit_rate = 12000000; // Recommended bitrate for 1080p60 SDR
+        
+        if (fmt->flags & AVFMT_GLOBALHEADER)
+            cdc_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+    
+    if (avcodec_open2(cdc_ctx, codec, NULL) < 0) ERROR("failed to open codec!");
+    
+    AVPacket *packet = av_packet_alloc();
+    if (!packet) ERROR("failed to allocate an AVPacket!");
+    
+    // All output goes through our own AVIOContext, see PAnimOutput
+    const int io_buffer_size = 64 * 1024;
+    unsigned char *io_buffer = (unsigned char *) av_malloc(io_buffer_size);
+    enc->io = avio_alloc_context(io_buffer, io_buffer_size, 1, &enc->output,
+                                 NULL, panim_output_write, panim_output_seek);
+    if (!io_buffer || !enc->io) ERROR("failed to allocate an AVIOContext!");
+    fmt_ctx->pb = enc->io;
+    fmt_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    
+    AVDictionary *options = NULL;
+    if (fragments > 0) {
+        char index[32]; snprintf(index, sizeof(index), "%zu", fragments + 1);
+        av_dict_set(&options, "movflags", "frag_custom+empty_moov+default_base_moof+frag_discont", 0);
+        av_dict_set(&options, "fragment_index", index, 0);
+    } else {
+        av_dict_set(&options, "movflags", "frag_custom+empty_moov+default_base_moof", 0);
+    }
+    
+    if (avformat_write_header(fmt_ctx, &options) < 0) {
+        ERROR("failed to write file header!");
+    }
+    av_dict_free(&options);
+    avio_flush(fmt_ctx->pb);
+    
+    if (fragments > 0 && enc->output.pos != header_bytes) {
+        ERROR("can't resume, the file header changed! Delete the journal to start over.");
+    }
+    
+    // Rewritten from scratch, as the last line may have been cut short
+    enc->journal = fopen(enc->journal_name, "w");
+    if (!enc->journal) ERROR("failed to open journal!");
+    fprintf(enc->journal, "panim journal %zu %zu %zu %lld\n",
+            scene->length_in_frames, from, to, (long long) enc->output.pos);
+    if (fragments > 0) {
+        fprintf(enc->journal, "%zu %zu %lld\n",
+                fragments, resume_frame, (long long) resume_bytes);
+    }
+    fflush(enc->journal);
+    enc->fragments = fragments;
+    
+    enc->fmt_ctx = fmt_ctx;
+    enc->stream = stream;
+    enc->cdc_ctx = cdc_ctx;
+    enc->packet = packet;
+    
+    if (fragments > 0) {
+        printf("Resuming at frame %zu\n", resume_frame);
+    }
+    return resume_frame;
+}
+
+static inline void
+panim_encoder_write(PAnimEncoder * enc, AVFrame * frame, size_t t)
+{
+    frame->pts = t - enc->from;
+    panim_frame_encode(enc, frame);
+}
+
+static void
+panim_encoder_close(PAnimEncoder * enc)
+{
+    panim_frame_encode(enc, NULL); // Flush the encoder
+    av_write_trailer(enc->fmt_ctx);
+    avio_flush(enc->fmt_ctx->pb);
+    
+    // A resumed render may have overwritten a longer, partial fragment
+    if (fflush(enc->output.file) != 0) ERROR("failed to write output file!");
+    PNM_TRUNCATE(enc->output.file, enc->output.file_pos);
+    fclose(enc->output.file);
+    
+    // Close the output stream
+    avcodec_close(enc->stream->codec);
+    av_packet_free(&enc->packet);
+    av_freep(&enc->io->buffer);
+    av_freep(&enc->io);
+    avformat_free_context(enc->fmt_ctx);
+    
+    // The file is complete, so there's nothing left to resume
+    fclose(enc->journal);
+    remove(enc->journal_name);
+}
+
+static struct SwsContext *
+panim_sws_context(int width, int height)
+{
+    struct SwsContext *sws_ctx = sws_getContext(
+        width, height, AV_PIX_FMT_RGB32,
+        width, height, AV_PIX_FMT_YUV420P,
+        0, 0, 0, 0);
+    if (!sws_ctx) ERROR("failed to get an SwsContext!");
+    return sws_ctx;
+}
+
+/*
+ * Copies the video streams of MP4 files that were rendered from consecutive
+ * frame ranges into a single file, one after the other, without
+ * re-encoding. Each input has to start on a key frame.
+ */
+static void
+panim_stitch(char * filename, char ** inputs, size_t input_count)
+{
+    av_register_all();
+    
+    AVFormatContext *out_ctx = NULL;
+    avformat_alloc_output_context2(&out_ctx, NULL, "mp4", filename);
+    if (!out_ctx) ERROR("failed to allocate an AVFormatContext");
+    
+    AVStream *out_stream = NULL;
+    AVPacket packet = {0};
+    int64_t offset = 0; // start of the current input in the output's time base
+    
+    for (size_t i = 0; i < input_count; ++i) {
+        AVFormatContext *in_ctx = NULL;
+        if (avformat_open_input(&in_ctx, inputs[i], NULL, NULL) < 0) {
+            ERROR("failed to open input file!");
+        }
+        if (avformat_find_stream_info(in_ctx, NULL) < 0 || in_ctx->nb_streams < 1) {
+            ERROR("failed to read input stream info!");
+        }
+        AVStream *in_stream = in_ctx->streams[0];
+        
+        if (!out_stream) {
+            out_stream = avformat_new_stream(out_ctx, NULL);
+            if (!out_stream) ERROR("failed to add video stream to container!");
+            if (avcodec_parameters_copy(out_stream->codecpar, in_stream->codecpar) < 0) {
+                ERROR("failed to copy codec parameters!");
+            }
+            out_stream->codecpar->codec_tag = 0;
+            out_stream->time_base = in_stream->time_base;
+            
+            if (!(out_ctx->oformat->flags & AVFMT_NOFILE)) {
+                if (avio_open(&out_ctx->pb, filename, AVIO_FLAG_WRITE) < 0) {
+                    ERROR("failed to open output file!");
+                }
+            }
+            if (avformat_write_header(out_ctx, NULL) < 0) {
+                ERROR("failed to write file header!");
+            }
+        }
+        
+        int64_t frame_duration = av_rescale_q(
+            1, (AVRational){1, 60}, out_stream->time_base);
+        int64_t shift = AV_NOPTS_VALUE;
+        int64_t end = offset;
+        
+        while (av_read_frame(in_ctx, &packet) >= 0) {
+            if (packet.stream_index != in_stream->index) {
+                av_packet_unref(&packet);
+                continue;
+            }
+            
+            av_packet_rescale_ts(&packet, in_stream->time_base, out_stream->time_base);
+            
+            // The first packet is the key frame the input starts with
+            if (shift == AV_NOPTS_VALUE) shift = offset - packet.pts;
+            packet.pts += shift;
+            packet.dts += shift;
+            
+            int64_t duration = packet.duration > 0 ? packet.duration : frame_duration;
+            if (packet.pts + duration > end) end = packet.pts + duration;
+            
+            packet.stream_index = out_stream->index;
+            packet.pos = -1;
+            if (av_interleaved_write_frame(out_ctx, &packet) < 0) {
+                ERROR("failed to write frame to stream");
+            }
+        }
+        
+        offset = end;
+        avformat_close_input(&in_ctx);
+    }
+    
+    if (!out_stream) ERROR("nothing to stitch!");
+    av_write_trailer(out_ctx);
+    
+    if (!(out_ctx->oformat->flags & AVFMT_NOFILE)) avio_closep(&out_ctx->pb);
+    avformat_free_context(out_ctx);
+}
+
+static inline uint64_t
+panim_pack32(int hi, int lo)
+{
+    return ((uint64_t)(uint32_t)hi << 32) | (uint32_t)lo;
+}
+
+/*
+ * Appends everything that determines what the most recently updated frame
+ * looks like to `words`: the screen-space state of each object that would
+ * be drawn, with images and text identified by a hash of their pixels.
+ */
+static void
+panim_frame_state_words(PAnimEngine * pnm, PAnimScene * scene, uint64_t ** words)
+{
+    buf_push(*words, (uint64_t) panim_color_key(scene->bg_color));
+    for (size_t i = 0; i < buf_len(scene->live); ++i) {
+        PAnimObject *src = scene->objects[scene->live[i]];
+        PAnimObject obj = panim_object_to_screen(scene, src);
+        if (!panim_object_visible(scene, &obj)) continue;
+        
+        buf_push(*words, panim_pack32(obj.type, obj.depth_level));
+        buf_push(*words, (uint64_t) panim_color_key(obj.color));
+        switch (obj.type) {
+            case PNM_OBJ_IMAGE: {
+                SDL_Rect loc = obj.img.location;
+                buf_push(*words, panim_engine_image(pnm, obj.img.texture)->hash);
+                buf_push(*words, panim_pack32(loc.x, loc.y));
+                buf_push(*words, panim_pack32(loc.w, loc.h));
+            } break;
+            case PNM_OBJ_TEXT: {
+                if (!src->txt.hash) src->txt.hash = panim_surface_hash(panim_text_surface(src));
+                SDL_Rect loc = panim_text_location(&obj, obj.txt.w, obj.txt.h);
+                buf_push(*words, src->txt.hash);
+                buf_push(*words, panim_pack32(loc.x, loc.y));
+                buf_push(*words, panim_pack32(loc.w, loc.h));
+            } break;
+            case PNM_OBJ_LINE: {
+                uint32_t width_bits;
+                memcpy(&width_bits, &obj.line.width, sizeof(width_bits));
+                buf_push(*words, panim_pack32(obj.line.x1, obj.line.y1));
+                buf_push(*words, panim_pack32(obj.line.x2, obj.line.y2));
+                buf_push(*words, panim_pack32(width_bits, obj.line.cap));
+            } break;
+            default: __debugbreak();
+        }
+    }
+}
+
+/*
+ * Checksums of each rendered frame, written as one line per frame with the
+ * frame number, a hash of the RGB32 pixels and a hash of the evaluated
+ * object state. Two manifests of the same scene can be compared with
+ * manifest_compare.c to find the first frame where two renders diverge.
+ */
+typedef struct {
+    FILE * file;
+    uint64_t * words; // scratch for the object state
+    size_t last_frame;
+} PAnimManifest;
+
+static void
+panim_manifest_open(PAnimManifest * manifest, const char * filename, PAnimScene * scene)
+{
+    memset(manifest, 0, sizeof(*manifest));
+    manifest->file = fopen(filename, "w");
+    if (!manifest->file) ERROR("failed to open manifest file!");
+    manifest->last_frame = PNM_FRAME_NEVER;
+    
+    fprintf(manifest->file, "panim manifest %d %d %zu\n",
+            scene->screen_width, scene->screen_height, scene->length_in_frames);
+}
+
+static uint64_t
+panim_manifest_state_hash(PAnimManifest * manifest, PAnimEngine * pnm, PAnimScene * scene)
+{
+    buf_clear(manifest->words);
+    panim_frame_state_words(pnm, scene, &manifest->words);
+    return panim_hash64(manifest->words, buf_sizeof(manifest->words), 0);
+}
+
+static void
+panim_manifest_write(PAnimManifest * manifest, size_t t,
+                     uint64_t pixels_hash, uint64_t state_hash)
+{
+    fprintf(manifest->file, "%zu %016llx %016llx\n", t,
+            (unsigned long long) pixels_hash, (unsigned long long) state_hash);
+    manifest->last_frame = t;
+}
+
+static void
+panim_manifest_close(PAnimManifest * manifest)
+{
+    if (fclose(manifest->file) != 0) ERROR("failed to write manifest file!");
+    buf_free(manifest->words);
+}
+
+/* 
+* Plays back the scene in a preview window while also rendering it to a file.
+* Only frames [from, to) are rendered, with `from` on a GOP boundary, so that
+* separately rendered parts can be stitched together later. Checksums of the
+* rendered frames go into `manifest` unless that's NULL. Parts of the scene
+* are retired along the way, so it can't be played again afterwards.
+*/
+static void
+panim_scene_render(PAnimEngine * pnm, PAnimScene * scene, char * filename,
+                   size_t from, size_t to, PAnimManifest * manifest)
+{
+    PAnimEncoder enc;
+    size_t start = panim_encoder_open(&enc, scene, filename, from, to);
+    
+    AVFrame *src_frame = panim_alloc_avframe(
+        AV_PIX_FMT_RGB32, scene->screen_width, scene->screen_height);
+    AVFrame *dst_frame = panim_alloc_avframe(
+        AV_PIX_FMT_YUV420P, scene->screen_width, scene->screen_height);
+    struct SwsContext *sws_ctx = panim_sws_context(
+        scene->screen_width, scene->screen_height);
+    
+    // 
+    // Main Loop
+    // 
+    
+    char title_buffer[1024];
+    
+    for (size_t t = start; t < to; ++t) {
+        snprintf(title_buffer, 1024, "PAnim - Rendering (%zd / %zd)",
+                 t, scene->length_in_frames);
+        panim_engine_set_title(pnm, title_buffer);
+        
+        
+        panim_scene_seek(scene, t);
+        panim_scene_frame_render(pnm, scene);
+        
+        // Get backbuffer contents
+        fflush(stdout);
+        if (av_frame_make_writable(src_frame) < 0)
+            ERROR("failed to lock frame buffer!");
+        panim_engine_read_pixels(pnm, src_frame->data[0], src_frame->linesize[0]);
+        
+        if (manifest) {
+            panim_manifest_write(manifest, t,
+                panim_pixels_hash(src_frame->data[0], src_frame->linesize[0],
+                                  src_frame->width, src_frame->height),
+                panim_manifest_state_hash(manifest, pnm, scene));
+        }
+        
+        // Convert between pixel formats (color spaces)
+        sws_scale(sws_ctx,
+                  src_frame->data, src_frame->linesize, 0, src_frame->height,
+                  dst_frame->data, dst_frame->linesize);
+        
+        panim_encoder_write(&enc, dst_frame, t);
+        panim_engine_present(pnm);
+        
+        if (t % PNM_RETIRE_INTERVAL == 0) panim_scene_retire(scene, true);
+    }
+    
+    panim_encoder_close(&enc);
+    av_frame_free(&src_frame);
+    av_frame_free(&dst_frame);
+    sws_freeContext(sws_ctx);
+}
+
+static size_t
+panim_live_lower_bound(PAnimScene * scene, size_t index)
+{
+    size_t lo = 0, hi = buf_len(scene->live);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (scene->live[mid] < index) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/*
+ * Brings the live-object list up to date for frame `t`. Moving forward only
+ * touches objects that spawn or despawn in between, moving backward starts
+ * over from the beginning of the scene.
+ */
+static void
+panim_scene_update_live(PAnimScene * scene, size_t t)
+{
+    if (t < scene->live_frame) {
+        buf_clear(scene->live);
+        scene->next_spawn = 0;
+        scene->next_despawn = 0;
+    }
+    scene->live_frame = t;
+    
+    while (scene->next_spawn < buf_len(scene->spawn_order) &&
+           scene->spawn_order[scene->next_spawn].frame <= t)
+    {
+        size_t index = scene->spawn_order[scene->next_spawn++].object;
+        if (scene->objects[index]->despawn_frame <= t) continue;
+        
+        size_t pos = panim_live_lower_bound(scene, index);
+        buf_push(scene->live, index);
+        memmove(scene->live + pos + 1, scene->live + pos,
+                (buf_len(scene->live) - 1 - pos) * sizeof(size_t));
+        scene->live[pos] = index;
+    }
+    
+    while (scene->next_despawn < buf_len(scene->despawn_order) &&
+           scene->despawn_order[scene->next_despawn].frame <= t)
+    {
+        size_t index = scene->despawn_order[scene->next_despawn++].object;
+        
+        size_t pos = panim_live_lower_bound(scene, index);
+        if (pos == buf_len(scene->live) || scene->live[pos] != index) continue;
+        
+        memmove(scene->live + pos, scene->live + pos + 1,
+                (buf_len(scene->live) - 1 - pos) * sizeof(size_t));
+        buf__hdr(scene->live)->len -= 1;
+    }
+}
+
+/*
+ * Brings the active-event list up to date for frame `t`, which can't be
+ * before the last one. Events that are over drop out, so ticking a frame
+ * only touches the events that can still change anything.
+ */
+static void
+panim_scene_update_active(PAnimScene * scene, size_t t)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < buf_len(scene->active); ++i) {
+        PAnimEvent *anim = scene->timeline + scene->active[i].event;
+        if ((size_t) anim->begin_frame + anim->length < t) continue;
+        if (kept != i) scene->active[kept] = scene->active[i];
+        ++kept;
+    }
+    if (scene->active) buf__hdr(scene->active)->len = kept;
+    
+    // The timeline is sorted by begin frame, so events beginning now come
+    // after all active ones, and the list stays in timeline order
+    while (scene->next_event < buf_len(scene->timeline) &&
+           scene->timeline[scene->next_event].begin_frame <= t)
+    {
+        PAnimEvent *anim = scene->timeline + scene->next_event;
+        if ((size_t) anim->begin_frame + anim->length >= t) {
+            buf_push(scene->active, (PAnimActiveEvent){ .event = (uint32_t) scene->next_event });
+        }
+        ++scene->next_event;
+    }
+}
+
+static inline void
+panim_scene_tick_active(PAnimScene * scene, size_t t)
+{
+    panim_scene_update_active(scene, t);
+    for (size_t i = 0; i < buf_len(scene->active); ++i) {
+        PAnimActiveEvent *active = scene->active + i;
+        panim_event_tick(scene->timeline + active->event, active, t);
+    }
+}
+
+static inline void
+panim_scene_frame_update(PAnimScene * scene, size_t t)
+{
+    panim_scene_tick_active(scene, t);
+    panim_scene_update_transforms(scene, false);
+    panim_scene_update_live(scene, t);
+    scene->frame = t;
+}
+
+/*
+ * Brings the scene to the state it would be in after updating every frame
+ * up to and including `t` in order, by only replaying the key frames since
+ * the most recently updated one. Can't go backwards.
+ */
+static void
+panim_scene_seek(PAnimScene * scene, size_t t)
+{
+    size_t from = scene->frame;
+    assert(from == PNM_FRAME_NEVER || from <= t);
+    
+    // Skipping the key frames up to and including `from`
+    size_t first = 0;
+    if (from != PNM_FRAME_NEVER) {
+        size_t hi = buf_len(scene->key_frames);
+        while (first < hi) {
+            size_t mid = first + (hi - first) / 2;
+            if (scene->key_frames[mid] <= from) first = mid + 1;
+            else hi = mid;
+        }
+    }
+    
+    for (size_t i = first; i < buf_len(scene->key_frames); ++i) {
+        size_t key = scene->key_frames[i];
+        if (key >= t) break;
+        panim_scene_tick_active(scene, key);
+    }
+    
+    panim_scene_frame_update(scene, t);
+}
+
+// Bytes of the text's texture, and of its surface if `surface` is set
+static size_t
+panim_text_bytes(PAnimObject * obj, bool surface)
+{
+    size_t bytes = 0;
+    if (obj->txt.texture) {
+        int w, h; SDL_QueryTexture(obj->txt.texture, NULL, NULL, &w, &h);
+        bytes += (size_t) w * (size_t) h * 4;
+    }
+    if (surface && obj->txt.surface) {
+        bytes += (size_t) obj->txt.surface->pitch * (size_t) obj->txt.surface->h;
+    }
+    return bytes;
+}
+
+/*
+ * Throws away what can't change any frame after the most recently updated
+ * one: events that are over, key frames and lifetime marks that were passed
+ * already, and, if `free_text` is set, the text rendered for objects that
+ * despawned for good. Copies made with panim_scene_clone share their text
+ * with the original, so they must not free it. Afterwards, the scene can
+ * only move forward, as in a render.
+ */
+static void
+panim_scene_retire(PAnimScene * scene, bool free_text)
+{
+    size_t t = scene->frame;
+    if (t == PNM_FRAME_NEVER) return;
+    
+    // Compacting keeps the timeline in order, and with it the active list
+    size_t kept = 0;
+    size_t next_active = 0;
+    size_t active_kept = 0;
+    size_t removed = 0;
+    for (size_t i = 0; i < buf_len(scene->timeline); ++i) {
+        PAnimActiveEvent *active = NULL;
+        if (next_active < buf_len(scene->active) && scene->active[next_active].event == i) {
+            active = scene->active + next_active++;
+        }
+        
+        PAnimEvent *anim = scene->timeline + i;
+        if ((size_t) anim->begin_frame + anim->length <= t) {
+            ++removed;
+            continue;
+        }
+        
+        if (active) {
+            scene->active[active_kept] = *active;
+            scene->active[active_kept++].event = (uint32_t) kept;
+        }
+        scene->timeline[kept++] = *anim;
+    }
+    if (scene->timeline) buf__hdr(scene->timeline)->len = kept;
+    if (scene->active) buf__hdr(scene->active)->len = active_kept;
+    
+    // Long renders hand the memory of past events back as they go, except
+    // for loaded scenes, where the timeline is part of the mapped file
+    if (!scene->file && buf_len(scene->timeline) < buf_cap(scene->timeline) / 2) {
+        buf_shrink_to_fit(scene->timeline);
+    }
+    
+    // Events that haven't begun yet aren't over either, so all removed
+    // ones were before this
+    scene->next_event -= removed;
+    
+    size_t passed = 0;
+    while (passed < buf_len(scene->key_frames) && scene->key_frames[passed] <= t) ++passed;
+    if (passed) {
+        memmove(scene->key_frames, scene->key_frames + passed,
+                (buf_len(scene->key_frames) - passed) * sizeof(uint32_t));
+        buf__hdr(scene->key_frames)->len -= passed;
+    }
+    
+    if (scene->next_spawn) {
+        memmove(scene->spawn_order, scene->spawn_order + scene->next_spawn,
+                (buf_len(scene->spawn_order) - scene->next_spawn) * sizeof(PAnimLifetimeMark));
+        buf__hdr(scene->spawn_order)->len -= scene->next_spawn;
+        scene->next_spawn = 0;
+    }
+    if (scene->next_despawn) {
+        memmove(scene->despawn_order, scene->despawn_order + scene->next_despawn,
+                (buf_len(scene->despawn_order) - scene->next_despawn) * sizeof(PAnimLifetimeMark));
+        buf__hdr(scene->despawn_order)->len -= scene->next_despawn;
+        scene->next_despawn = 0;
+    }
+    
+    if (!free_text) return;
+    for (size_t i = 0; i < buf_len(scene->objects); ++i) {
+        PAnimObject *obj = scene->objects[i];
+        if (obj->type != PNM_OBJ_TEXT || obj->despawn_frame > t) continue;
+        
+        if (obj->txt.texture) SDL_DestroyTexture(obj->txt.texture);
+        if (obj->txt.surface) SDL_FreeSurface(obj->txt.surface);
+        obj->txt.texture = NULL;
+        obj->txt.surface = NULL;
+    }
+    
+    // Text freed here is cached again when drawn again, so it has to go now
+    size_t text_kept = 0;
+    scene->text_cache_bytes = 0;
+    for (size_t i = 0; i < buf_len(scene->text_cache); ++i) {
+        PAnimObject *obj = scene->text_cache[i];
+        if (!obj->txt.texture && !obj->txt.surface) continue;
+        
+        scene->text_cache_bytes += panim_text_bytes(obj, !scene->text_shared);
+        scene->text_cache[text_kept++] = obj;
+    }
+    if (scene->text_cache) buf__hdr(scene->text_cache)->len = text_kept;
+}
+
+typedef struct {
+    uintptr_t begin;
+    size_t size;
+    char * copy;
+} PAnimPtrMapping;
+
+static int
+panim_ptr_mapping_sort(const PAnimPtrMapping * a, const PAnimPtrMapping * b)
+{
+    if (a->begin < b->begin) return -1;
+    if (a->begin > b->begin) return  1;
+    return 0;
+}
+
+static void *
+panim_ptr_remap(PAnimPtrMapping * map, void * ptr)
+{
+    if (!ptr) return NULL;
+    
+    uintptr_t addr = (uintptr_t) ptr;
+    size_t lo = 0, hi = buf_len(map);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (map[mid].begin <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    
+    if (lo == 0 || addr >= map[lo - 1].begin + map[lo - 1].size) {
+        ERROR("event targets memory outside the scene, can't copy it!");
+    }
+    return map[lo - 1].copy + (addr - map[lo - 1].begin);
+}
+
+/*
+ * Makes an independent copy of the state of a finalized, not yet updated
+ * scene, sharing only read-only data like fonts, textures and text. Every
+ * event has to target the scene's objects or camera.
+ */
+static void
+panim_scene_clone(PAnimScene * dst, PAnimScene * src)
+{
+    assert(src->frame == PNM_FRAME_NEVER);
+    
+    size_t object_count = buf_len(src->objects);
+    size_t group_count = buf_len(src->groups);
+    
+    *dst = *src;
+    dst->objects = NULL;
+    dst->groups = NULL;
+    dst->timeline = NULL;
+    dst->spawn_order = NULL;
+    dst->despawn_order = NULL;
+    dst->live = NULL;
+    dst->active = NULL;
+    dst->key_frames = NULL;
+    dst->text_cache = NULL;
+    dst->text_cache_bytes = 0;
+    dst->arena = NULL;
+    dst->file = NULL;
+    dst->file_size = 0;
+    
+    // All copies live in a single block, freed with the first object
+    PAnimObject *block = NULL;
+    if (object_count + group_count > 0) {
+        block = (PAnimObject *) malloc((object_count + group_count) * sizeof(PAnimObject));
+        if (!block) ERROR("out of memory!");
+    }
+    
+    PAnimPtrMapping *map = NULL;
+    buf_push(map, (PAnimPtrMapping){
+        (uintptr_t)&src->camera, sizeof(PAnimCamera), (char *)&dst->camera });
+    for (size_t i = 0; i < object_count; ++i) {
+        block[i] = *src->objects[i];
+        buf_push(dst->objects, block + i);
+        buf_push(map, (PAnimPtrMapping){
+            (uintptr_t)src->objects[i], sizeof(PAnimObject), (char *)(block + i) });
+    }
+    for (size_t i = 0; i < group_count; ++i) {
+        block[object_count + i] = *src->groups[i];
+        buf_push(dst->groups, block + object_count + i);
+        buf_push(map, (PAnimPtrMapping){
+            (uintptr_t)src->groups[i], sizeof(PAnimObject), (char *)(block + object_count + i) });
+    }
+    buf_sort(map, panim_ptr_mapping_sort);
+    
+    for (size_t i = 0; i < object_count + group_count; ++i) {
+        block[i].parent = (PAnimObject *) panim_ptr_remap(map, block[i].parent);
+    }
+    
+    for (size_t i = 0; i < buf_len(src->timeline); ++i) {
+        PAnimEvent anim = src->timeline[i];
+        switch (anim.type) {
+            case PNM_EVENT_COLOR_FADE: {
+                anim.colfd.object = (PAnimObject *) panim_ptr_remap(map, anim.colfd.object);
+            } break;
+            case PNM_EVENT_MOVEMENT: {
+                anim.move.x_val = (int *) panim_ptr_remap(map, anim.move.x_val);
+                anim.move.y_val = (int *) panim_ptr_remap(map, anim.move.y_val);
+            } break;
+            case PNM_EVENT_COLOCATE: {
+                anim.copy_pos.src = (PAnimObject *) panim_ptr_remap(map, anim.copy_pos.src);
+                anim.copy_pos.dst = (PAnimObject *) panim_ptr_remap(map, anim.copy_pos.dst);
+            } break;
+            case PNM_EVENT_TWEEN: {
+                anim.tween.value = (float *) panim_ptr_remap(map, anim.tween.value);
+            } break;
+            default: __debugbreak();
+        }
+        buf_push(dst->timeline, anim);
+    }
+    
+    for (size_t i = 0; i < buf_len(src->spawn_order); ++i)
+        buf_push(dst->spawn_order, src->spawn_order[i]);
+    for (size_t i = 0; i < buf_len(src->despawn_order); ++i)
+        buf_push(dst->despawn_order, src->despawn_order[i]);
+    for (size_t i = 0; i < buf_len(src->key_frames); ++i)
+        buf_push(dst->key_frames, src->key_frames[i]);
+    
+    buf_free(map);
+}
+
+static void
+panim_scene_clone_free(PAnimScene * clone)
+{
+    // Objects and groups were allocated as one block, objects first,
+    // unless there are no objects at all
+    if (buf_len(clone->objects)) free(clone->objects[0]);
+    else if (buf_len(clone->groups)) free(clone->groups[0]);
+    
+    buf_free(clone->objects);
+    buf_free(clone->groups);
+    buf_free(clone->timeline);
+    buf_free(clone->spawn_order);
+    buf_free(clone->despawn_order);
+    buf_free(clone->live);
+    buf_free(clone->active);
+    buf_free(clone->key_frames);
+    buf_free(clone->text_cache);
+}
+
+static int
+panim_text_lru_sort(const PAnimObject ** a, const PAnimObject ** b)
+{
+    if ((*a)->txt.last_drawn < (*b)->txt.last_drawn) return -1;
+    if ((*a)->txt.last_drawn > (*b)->txt.last_drawn) return  1;
+    return 0;
+}
+
+/*
+ * Once the scene keeps more than `budget` bytes of rendered text, frees the
+ * text drawn least recently, down to three quarters of the budget. Text
+ * drawn in the current frame stays, anything else is rendered again the
+ * next time it is drawn. Surfaces shared with copies of the scene stay too.
+ */
+static void
+panim_scene_evict_text(PAnimScene * scene, size_t budget)
+{
+    if (budget == 0 || scene->text_cache_bytes <= budget) return;
+    
+    // Recounting first, as surfaces stop counting once they are shared
+    bool surfaces = !scene->text_shared;
+    size_t kept = 0;
+    size_t bytes = 0;
+    for (size_t i = 0; i < buf_len(scene->text_cache); ++i) {
+        PAnimObject *obj = scene->text_cache[i];
+        size_t size = panim_text_bytes(obj, surfaces);
+        if (size == 0) continue;
+        
+        bytes += size;
+        scene->text_cache[kept++] = obj;
+    }
+    if (scene->text_cache) buf__hdr(scene->text_cache)->len = kept;
+    
+    if (bytes > budget) {
+        buf_sort(scene->text_cache, panim_text_lru_sort);
+        
+        size_t evicted = 0;
+        while (evicted < kept && bytes > budget / 4 * 3) {
+            PAnimObject *obj = scene->text_cache[evicted];
+            if (obj->txt.last_drawn == scene->text_clock) break;
+            
+            bytes -= panim_text_bytes(obj, surfaces);
+            if (obj->txt.texture) SDL_DestroyTexture(obj->txt.texture);
+            obj->txt.texture = NULL;
+            if (surfaces && obj->txt.surface) {
+                SDL_FreeSurface(obj->txt.surface);
+                obj->txt.surface = NULL;
+            }
+            ++evicted;
+        }
+        
+        if (evicted) {
+            memmove(scene->text_cache, scene->text_cache + evicted,
+                    (kept - evicted) * sizeof(PAnimObject *));
+            buf__hdr(scene->text_cache)->len = kept - evicted;
+        }
+    }
+    
+    scene->text_cache_bytes = bytes;
+}
+
+static inline void
+panim_scene_frame_render(PAnimEngine * pnm, PAnimScene * scene)
+{
+    // Objects outside their lifetime never make it into the live list,
+    // leaving only transparent and off-screen ones to be culled here.
+    scene->text_clock += 1;
+    buf_clear(pnm->draw_list);
+    for (size_t i = 0; i < buf_len(scene->live); ++i) {
+        PAnimObject *src = scene->objects[scene->live[i]];
+        PAnimObject obj = panim_object_to_screen(scene, src);
+        if (!panim_object_visible(scene, &obj)) continue;
+        
+        if (src->type != PNM_OBJ_TEXT) {
+            panim_object_emit(pnm, src, &obj);
+            continue;
+        }
+        
+        // Text rendered just now counts against the engine's budget
+        SDL_Texture *texture = src->txt.texture;
+        SDL_Surface *surface = src->txt.surface;
+        panim_object_emit(pnm, src, &obj);
+        src->txt.last_drawn = scene->text_clock;
+        if (src->txt.texture != texture || src->txt.surface != surface) {
+            buf_push(scene->text_cache, src);
+            scene->text_cache_bytes += panim_text_bytes(src, !scene->text_shared);
+        }
+    }
+    
+    buf_sort(pnm->draw_list, panim_draw_cmd_sort);
+    
+    if (pnm->backend == PNM_BACKEND_CPU) {
+        panim_raster_render(pnm->raster, pnm->draw_list, scene->bg_color);
+    } else {
+        SDL_Color bg = scene->bg_color;
+        SDL_SetRenderDrawColor(
+            pnm->renderer, bg.r, bg.g, bg.b, bg.a);
+        SDL_RenderClear(pnm->renderer);
+        
+        panim_draw_list_submit(pnm);
+    }
+    
+    panim_scene_evict_text(scene, pnm->text_budget);
+}
+
+// Frames handed out to a render worker at a time
+#define PNM_RENDER_CHUNK 4
+
+typedef struct {
+    size_t from;
+    size_t to;
+    size_t chunk_count;
+    SDL_atomic_t next_chunk;
+    
+    // Reorder buffer; frame t goes into slot t % slot_count once all frames
+    // up to t - slot_count have been encoded
+    AVFrame ** slots;
+    size_t * slot_frames; // frame held by each slot, PNM_FRAME_NEVER if none
+    size_t slot_count;
+    size_t next_encode;
+    
+    // Checksums of the frame in each slot, only computed with a manifest
+    bool checksums;
+    uint64_t * slot_pixels_hashes;
+    uint64_t * slot_state_hashes;
+    
+    SDL_mutex * lock;
+    SDL_cond * changed;
+} PAnimParallelRender;
+
+typedef struct {
+    PAnimParallelRender * shared;
+    SDL_Thread * thread;
+    
+    PAnimScene scene;
+    PAnimEngine pnm;
+    struct SwsContext * sws_ctx;
+    uint64_t * state_words;
+} PAnimRenderWorker;
+
+static int
+panim_render_worker(void * data)
+{
+    PAnimRenderWorker *worker = (PAnimRenderWorker *) data;
+    PAnimParallelRender *shared = worker->shared;
+    PAnimScene *scene = &worker->scene;
+    PAnimRaster *ras = worker->pnm.raster;
+    
+    for (;;) {
+        size_t chunk = (size_t) SDL_AtomicAdd(&shared->next_chunk, 1);
+        if (chunk >= shared->chunk_count) break;
+        
+        size_t first = shared->from + chunk * PNM_RENDER_CHUNK;
+        size_t end = first + PNM_RENDER_CHUNK;
+        if (end > shared->to) end = shared->to;
+        
+        // Each worker only moves forward through its copy
+        if (scene->frame / PNM_RETIRE_INTERVAL != first / PNM_RETIRE_INTERVAL) {
+            panim_scene_retire(scene, false);
+        }
+        
+        for (size_t t = first; t < end; ++t) {
+            panim_scene_seek(scene, t);
+            panim_scene_frame_render(&worker->pnm, scene);
+            
+            SDL_LockMutex(shared->lock);
+            while (t >= shared->next_encode + shared->slot_count) {
+                SDL_CondWait(shared->changed, shared->lock);
+            }
+            SDL_UnlockMutex(shared->lock);
+            
+            AVFrame *slot = shared->slots[t % shared->slot_count];
+            if (av_frame_make_writable(slot) < 0) ERROR("failed to lock frame buffer!");
+            
+            const uint8_t *src_data[1] = { (const uint8_t *) ras->pixels };
+            int src_stride[1] = { ras->width * (int)sizeof(Uint32) };
+            sws_scale(worker->sws_ctx, src_data, src_stride, 0, ras->height,
+                      slot->data, slot->linesize);
+            
+            if (shared->checksums) {
+                buf_clear(worker->state_words);
+                panim_frame_state_words(&worker->pnm, scene, &worker->state_words);
+                shared->slot_state_hashes[t % shared->slot_count] = panim_hash64(
+                    worker->state_words, buf_sizeof(worker->state_words), 0);
+                shared->slot_pixels_hashes[t % shared->slot_count] = panim_pixels_hash(
+                    ras->pixels, src_stride[0], ras->width, ras->height);
+            }
+            
+            SDL_LockMutex(shared->lock);
+            shared->slot_frames[t % shared->slot_count] = t;
+            SDL_CondBroadcast(shared->changed);
+            SDL_UnlockMutex(shared->lock);
+        }
+    }
+    
+    return 0;
+}
+
+/*
+ * Renders text of all objects up front, as neither SDL_ttf nor the lazy
+ * caching in the text objects themselves are thread-safe. Copies of the
+ * scene then share the surfaces, so they can't be evicted anymore.
+ */
+static void
+panim_scene_prepare_text(PAnimScene * scene)
+{
+    scene->text_shared = true;
+    for (size_t i = 0; i < buf_len(scene->objects); ++i) {
+        PAnimObject *obj = scene->objects[i];
+        if (obj->type != PNM_OBJ_TEXT) continue;
+        
+        panim_text_measure(obj);
+        panim_text_surface(obj);
+    }
+}
+
+/*
+ * Renders the scene to a file with `worker_count` threads each rendering
+ * whole frames on their own copy of the scene, using the CPU backend.
+ * Workers take turns claiming chunks of consecutive frames, seeking ahead
+ * to the start of each, while the calling thread encodes the finished
+ * frames in order, and writes their checksums to `manifest` if given.
+ */
+static void
+panim_scene_render_parallel(PAnimEngine * pnm, PAnimScene * scene,
+                            char * filename, size_t from, size_t to,
+                            int worker_count, PAnimManifest * manifest)
+{
+    PAnimEncoder enc;
+    size_t start = panim_encoder_open(&enc, scene, filename, from, to);
+    
+    panim_scene_prepare_text(scene);
+    
+    PAnimParallelRender shared = {0};
+    shared.from = start;
+    shared.to = to;
+    shared.chunk_count = (to - start + PNM_RENDER_CHUNK - 1) / PNM_RENDER_CHUNK;
+    shared.next_encode = start;
+    shared.slot_count = 2 * worker_count * PNM_RENDER_CHUNK;
+    shared.slots = (AVFrame **) calloc(shared.slot_count, sizeof(AVFrame *));
+    shared.slot_frames = (size_t *) calloc(shared.slot_count, sizeof(size_t));
+    shared.checksums = manifest != NULL;
+    shared.slot_pixels_hashes = (uint64_t *) calloc(shared.slot_count, sizeof(uint64_t));
+    shared.slot_state_hashes = (uint64_t *) calloc(shared.slot_count, sizeof(uint64_t));
+    for (size_t i = 0; i < shared.slot_count; ++i) {
+        shared.slots[i] = panim_alloc_avframe(
+            AV_PIX_FMT_YUV420P, scene->screen_width, scene->screen_height);
+        shared.slot_frames[i] = PNM_FRAME_NEVER;
+    }
+    
+    shared.lock = SDL_CreateMutex();
+    shared.changed = SDL_CreateCond();
+    if (!shared.lock || !shared.changed) ERROR("failed to create mutex!");
+    
+    PAnimRenderWorker *workers = (PAnimRenderWorker *) calloc(
+        worker_count, sizeof(PAnimRenderWorker));
+    for (int i = 0; i < worker_count; ++i) {
+        PAnimRenderWorker *worker = workers + i;
+        worker->shared = &shared;
+        panim_scene_clone(&worker->scene, scene);
+        
+        // Rasterizes on the worker thread alone, sharing only loaded images
+        worker->pnm.backend = PNM_BACKEND_CPU;
+        worker->pnm.images = pnm->images;
+        worker->pnm.raster = panim_raster_create(
+            scene->screen_width, scene->screen_height, 1);
+        worker->sws_ctx = panim_sws_context(scene->screen_width, scene->screen_height);
+    }
+    for (int i = 0; i < worker_count; ++i) {
+        workers[i].thread = SDL_CreateThread(panim_render_worker, "PAnim Renderer", workers + i);
+        if (!workers[i].thread) ERROR("failed to create worker thread!");
+    }
+    
+    char title_buffer[1024];
+    
+    for (size_t t = start; t < to; ++t) {
+        snprintf(title_buffer, 1024, "PAnim - Rendering (%zd / %zd)",
+                 t, scene->length_in_frames);
+        panim_engine_set_title(pnm, title_buffer);
+        if (pnm->window) SDL_PumpEvents();
+        
+        size_t slot = t % shared.slot_count;
+        SDL_LockMutex(shared.lock);
+        while (shared.slot_frames[slot] != t) {
+            SDL_CondWait(shared.changed, shared.lock);
+        }
+        SDL_UnlockMutex(shared.lock);
+        
+        panim_encoder_write(&enc, shared.slots[slot], t);
+        if (manifest) {
+            panim_manifest_write(manifest, t, shared.slot_pixels_hashes[slot],
+                                 shared.slot_state_hashes[slot]);
+        }
+        
+        SDL_LockMutex(shared.lock);
+        shared.slot_frames[slot] = PNM_FRAME_NEVER;
+        shared.next_encode = t + 1;
+        SDL_CondBroadcast(shared.changed);
+        SDL_UnlockMutex(shared.lock);
+    }
+    
+    panim_encoder_close(&enc);
+    
+    for (int i = 0; i < worker_count; ++i) {
+        PAnimRenderWorker *worker = workers + i;
+        SDL_WaitThread(worker->thread, NULL);
+        
+        panim_scene_clone_free(&worker->scene);
+        panim_raster_destroy(worker->pnm.raster);
+        buf_free(worker->pnm.draw_list);
+        buf_free(worker->state_words);
+        sws_freeContext(worker->sws_ctx);
+    }
+    free(workers);
+    
+    for (size_t i = 0; i < shared.slot_count; ++i) av_frame_free(&shared.slots[i]);
+    free(shared.slots);
+    free(shared.slot_frames);
+    free(shared.slot_pixels_hashes);
+    free(shared.slot_state_hashes);
+    SDL_DestroyCond(shared.changed);
+    SDL_DestroyMutex(shared.lock);
+}
+
+//
+// Preview Frame Cache
+//
+
+// Frames are compressed with run-length encoding of whole pixels. Each run
+// starts with a header word, holding either the number of literal pixels
+// that follow, or, with the top bit set, how often to repeat the next one.
+#define PNM_RLE_REPEAT 0x80000000u
+#define PNM_RLE_MAX    0x7FFFFFFFu
+
+static void
+panim_rle_append(Uint32 ** out, const Uint32 * pixels, size_t count)
+{
+    buf_fit(*out, buf_len(*out) + count);
+    memcpy(*out + buf_len(*out), pixels, count * sizeof(Uint32));
+    buf__hdr(*out)->len += count;
+}
+
+static void
+panim_rle_encode(Uint32 ** out, const Uint32 * p, size_t n)
+{
+    buf_clear(*out);
+    for (size_t i = 0; i < n;) {
+        size_t run = 1;
+        while (i + run < n && run < PNM_RLE_MAX && p[i + run] == p[i]) ++run;
+        if (run >= 3) {
+            buf_push(*out, PNM_RLE_REPEAT | (Uint32) run);
+            buf_push(*out, p[i]);
+            i += run;
+            continue;
+        }
+        
+        // Literals up to where the next run of at least three begins
+        size_t begin = i;
+        while (i < n && i - begin < PNM_RLE_MAX &&
+               !(i + 2 < n && p[i] == p[i + 1] && p[i] == p[i + 2])) ++i;
+        buf_push(*out, (Uint32)(i - begin));
+        panim_rle_append(out, p + begin, i - begin);
+    }
+}
+
+static void
+panim_rle_decode(Uint32 * p, const Uint32 * in, size_t word_count)
+{
+    const Uint32 *end = in + word_count;
+    while (in < end) {
+        Uint32 header = *in++;
+        Uint32 count = header & PNM_RLE_MAX;
+        if (header & PNM_RLE_REPEAT) {
+            Uint32 value = *in++;
+            for (Uint32 i = 0; i < count; ++i) p[i] = value;
+        } else {
+            memcpy(p, in, count * sizeof(Uint32));
+            in += count;
+        }
+        p += count;
+    }
+}
+
+typedef struct {
+    Uint32 * data; // compressed, NULL while not cached
+    size_t word_count;
+    uint64_t data_hash; // tells apart frames that look different
+    uint64_t pixels_hash; // only computed with a manifest
+    uint64_t state_hash;
+} PAnimCachedFrame;
+
+/*
+ * Renders frames for the preview on a background thread, ahead of the one
+ * being shown in the direction of playback, and keeps them compressed in
+ * memory up to a budget. When the preview skips frames, the ones it will
+ * show are rendered first. Once everything ahead is cached, it wraps around,
+ * so that playback can loop. The producer plays back a copy of the scene,
+ * seeking from the start whenever it needs to go back in time, and always
+ * renders with the CPU backend.
+ */
+typedef struct {
+    PAnimScene * scene; // never played back itself, so it can be copied again
+    PAnimScene copy;
+    PAnimEngine pnm;
+    bool owns_raster;
+    bool checksums;
+    Uint32 * scratch;
+    uint64_t * state_words;
+    
+    // Shared with the preview, guarded by `lock`
+    PAnimCachedFrame * frames; // one per frame of the scene
+    size_t bytes;
+    size_t budget;
+    size_t playhead;
+    size_t stride;  // how many frames the preview advances at a time
+    size_t pinned;  // being decompressed by the preview, so never evicted
+    bool reverse;
+    bool quit;
+    
+    SDL_mutex * lock;
+    SDL_cond * changed;
+    SDL_Thread * thread;
+} PAnimFrameCache;
+
+// How many frames from the playhead `t` is, in playback order
+static inline size_t
+panim_frame_cache_distance(PAnimFrameCache * cache, size_t t)
+{
+    size_t length = cache->scene->length_in_frames;
+    size_t from = cache->reverse ? t : cache->playhead;
+    size_t to = cache->reverse ? cache->playhead : t;
+    return to >= from ? to - from : to + length - from;
+}
+
+/*
+ * Evicts frames further from the playhead than frame `t` while over budget,
+ * returns whether there is room for `t` then. Call with the lock held.
+ */
+static bool
+panim_frame_cache_evict(PAnimFrameCache * cache, size_t t)
+{
+    size_t length = cache->scene->length_in_frames;
+    while (cache->bytes >= cache->budget) {
+        size_t victim = PNM_FRAME_NEVER;
+        for (size_t u = 0; u < length; ++u) {
+            if (!cache->frames[u].data || u == cache->pinned) continue;
+            if (victim == PNM_FRAME_NEVER ||
+                panim_frame_cache_distance(cache, u) > panim_frame_cache_distance(cache, victim))
+            {
+                victim = u;
+            }
+        }
+        
+        if (victim == PNM_FRAME_NEVER ||
+            panim_frame_cache_distance(cache, victim) <= panim_frame_cache_distance(cache, t))
+        {
+            return false;
+        }
+        
+        cache->bytes -= cache->frames[victim].word_count * sizeof(Uint32);
+        free(cache->frames[victim].data);
+        cache->frames[victim].data = NULL;
+    }
+    return true;
+}
+
+/*
+ * Picks the next frame to render, making room for it. Returns
+ * PNM_FRAME_NEVER if there is nothing to do. Call with the lock held.
+ */
+static size_t
+panim_frame_cache_next(PAnimFrameCache * cache)
+{
+    size_t length = cache->scene->length_in_frames;
+    size_t next = PNM_FRAME_NEVER;
+    
+    // First the frames the preview is going to show, up to the end
+    for (size_t t = cache->playhead; cache->stride > 1 && t < length;) {
+        if (!cache->frames[t].data) {
+            next = t;
+            break;
+        }
+        if (cache->reverse && t < cache->stride) break;
+        t = cache->reverse ? t - cache->stride : t + cache->stride;
+    }
+    
+    for (size_t i = 0; next == PNM_FRAME_NEVER && i < length; ++i) {
+        size_t t = cache->reverse ? (cache->playhead + length - i) % length
+                                  : (cache->playhead + i) % length;
+        if (!cache->frames[t].data) next = t;
+    }
+    if (next == PNM_FRAME_NEVER || !panim_frame_cache_evict(cache, next)) {
+        return PNM_FRAME_NEVER;
+    }
+    return next;
+}
+
+/*
+ * Renders frame `t` into the cache, unless it's already there. Frames
+ * rendered on the way to the one picked, as when filling in a GOP backwards,
+ * only stay if there is room for them.
+ */
+static void
+panim_frame_cache_render(PAnimFrameCache * cache, size_t t)
+{
+    PAnimRaster *ras = cache->pnm.raster;
+    
+    SDL_LockMutex(cache->lock);
+    bool cached = cache->frames[t].data != NULL;
+    SDL_UnlockMutex(cache->lock);
+    if (cached) return;
+    
+    panim_scene_seek(&cache->copy, t);
+    panim_scene_frame_render(&cache->pnm, &cache->copy);
+    
+    PAnimCachedFrame frame = {0};
+    panim_rle_encode(&cache->scratch, ras->pixels, (size_t)ras->width * ras->height);
+    frame.word_count = buf_len(cache->scratch);
+    frame.data = (Uint32 *) malloc(buf_sizeof(cache->scratch));
+    if (!frame.data) ERROR("out of memory!");
+    memcpy(frame.data, cache->scratch, buf_sizeof(cache->scratch));
+    frame.data_hash = panim_hash64(frame.data, buf_sizeof(cache->scratch), 0);
+    
+    if (cache->checksums) {
+        buf_clear(cache->state_words);
+        panim_frame_state_words(&cache->pnm, &cache->copy, &cache->state_words);
+        frame.state_hash = panim_hash64(cache->state_words, buf_sizeof(cache->state_words), 0);
+        frame.pixels_hash = panim_pixels_hash(ras->pixels, ras->width * sizeof(Uint32),
+                                              ras->width, ras->height);
+    }
+    
+    SDL_LockMutex(cache->lock);
+    if (panim_frame_cache_evict(cache, t)) {
+        cache->frames[t] = frame;
+        cache->bytes += frame.word_count * sizeof(Uint32);
+        SDL_CondBroadcast(cache->changed);
+    } else {
+        free(frame.data);
+    }
+    SDL_UnlockMutex(cache->lock);
+}
+
+static int
+panim_frame_cache_producer(void * data)
+{
+    PAnimFrameCache *cache = (PAnimFrameCache *) data;
+    
+    SDL_LockMutex(cache->lock);
+    while (!cache->quit) {
+        size_t t = panim_frame_cache_next(cache);
+        if (t == PNM_FRAME_NEVER) {
+            SDL_CondWait(cache->changed, cache->lock);
+            continue;
+        }
+        bool reverse = cache->reverse;
+        SDL_UnlockMutex(cache->lock);
+        
+        // Going back means seeking from the start. When playing in reverse,
+        // that happens once per GOP, rendering it front to back.
+        size_t first = t;
+        if (cache->copy.frame != PNM_FRAME_NEVER && cache->copy.frame > t) {
+            panim_scene_clone_free(&cache->copy);
+            panim_scene_clone(&cache->copy, cache->scene);
+            if (reverse) first = t - MIN(t, PNM_GOP_SIZE - 1);
+        }
+        for (size_t u = first; u <= t; ++u) panim_frame_cache_render(cache, u);
+        
+        SDL_LockMutex(cache->lock);
+    }
+    SDL_UnlockMutex(cache->lock);
+    
+    return 0;
+}
+
+/*
+ * Starts rendering frames of a finalized, not yet played back scene.
+ * The budget in megabytes can be set with PANIM_CACHE_MB.
+ */
+static void
+panim_frame_cache_start(PAnimFrameCache * cache, PAnimEngine * pnm,
+                        PAnimScene * scene, bool checksums)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->scene = scene;
+    cache->checksums = checksums;
+    
+    size_t budget_mb = 512;
+    const char *budget = SDL_getenv("PANIM_CACHE_MB");
+    if (budget && atoi(budget) > 0) budget_mb = (size_t) atoi(budget);
+    cache->budget = budget_mb * 1024 * 1024;
+    
+    cache->pinned = PNM_FRAME_NEVER;
+    cache->frames = (PAnimCachedFrame *) calloc(
+        MAX(1, scene->length_in_frames), sizeof(PAnimCachedFrame));
+    if (!cache->frames) ERROR("out of memory!");
+    
+    // The CPU backend's rasterizer is free to use, as the preview only
+    // shows cached frames
+    panim_scene_prepare_text(scene);
+    panim_scene_clone(&cache->copy, scene);
+    cache->pnm.backend = PNM_BACKEND_CPU;
+    cache->pnm.images = pnm->images;
+    cache->pnm.raster = pnm->raster;
+    if (!cache->pnm.raster) {
+        cache->pnm.raster = panim_raster_create(
+            scene->screen_width, scene->screen_height, panim_thread_count());
+        cache->owns_raster = true;
+    }
+    
+    cache->lock = SDL_CreateMutex();
+    cache->changed = SDL_CreateCond();
+    if (!cache->lock || !cache->changed) ERROR("failed to create mutex!");
+    
+    cache->thread = SDL_CreateThread(panim_frame_cache_producer, "PAnim Preview", cache);
+    if (!cache->thread) ERROR("failed to create thread!");
+}
+
+static void
+panim_frame_cache_stop(PAnimFrameCache * cache)
+{
+    SDL_LockMutex(cache->lock);
+    cache->quit = true;
+    SDL_CondBroadcast(cache->changed);
+    SDL_UnlockMutex(cache->lock);
+    SDL_WaitThread(cache->thread, NULL);
+    
+    for (size_t t = 0; t < cache->scene->length_in_frames; ++t) free(cache->frames[t].data);
+    free(cache->frames);
+    
+    panim_scene_clone_free(&cache->copy);
+    if (cache->owns_raster) panim_raster_destroy(cache->pnm.raster);
+    buf_free(cache->pnm.draw_list);
+    buf_free(cache->scratch);
+    buf_free(cache->state_words);
+    SDL_DestroyCond(cache->changed);
+    SDL_DestroyMutex(cache->lock);
+}
+
+/*
+ * If frame `t` is cached, copies its entry into `frame`, and decompresses it
+ * into `pixels` unless it looks the same as the one with hash `shown`. The
+ * frame is pinned while decompressing, so the producer can go on meanwhile.
+ */
+static bool
+panim_frame_cache_get(PAnimFrameCache * cache, size_t t, Uint32 * pixels,
+                      uint64_t shown, PAnimCachedFrame * frame)
+{
+    SDL_LockMutex(cache->lock);
+    bool cached = cache->frames[t].data != NULL;
+    if (cached) {
+        *frame = cache->frames[t];
+        cache->pinned = t;
+    }
+    SDL_UnlockMutex(cache->lock);
+    if (!cached) return false;
+    
+    if (frame->data_hash != shown) {
+        panim_rle_decode(pixels, frame->data, frame->word_count);
+    }
+    
+    SDL_LockMutex(cache->lock);
+    cache->pinned = PNM_FRAME_NEVER;
+    SDL_UnlockMutex(cache->lock);
+    return true;
+}
+
+// Blocks until frame `t` is cached, or `ms` milliseconds have passed
+static void
+panim_frame_cache_wait(PAnimFrameCache * cache, size_t t, Uint32 ms)
+{
+    SDL_LockMutex(cache->lock);
+    if (!cache->frames[t].data) SDL_CondWaitTimeout(cache->changed, cache->lock, ms);
+    SDL_UnlockMutex(cache->lock);
+}
+
+static void
+panim_frame_cache_seek(PAnimFrameCache * cache, size_t t, size_t stride, bool reverse)
+{
+    SDL_LockMutex(cache->lock);
+    if (cache->playhead != t || cache->stride != stride || cache->reverse != reverse) {
+        cache->playhead = t;
+        cache->stride = stride;
+        cache->reverse = reverse;
+        SDL_CondBroadcast(cache->changed);
+    }
+    SDL_UnlockMutex(cache->lock);
+}
+
+// Marks each of `width` columns of the timeline that has any cached frames
+static void
+panim_frame_cache_columns(PAnimFrameCache * cache, bool * columns, int width)
+{
+    size_t length = cache->scene->length_in_frames;
+    memset(columns, 0, width * sizeof(bool));
+    
+    SDL_LockMutex(cache->lock);
+    for (size_t t = 0; t < length; ++t) {
+        if (cache->frames[t].data) columns[t * width / length] = true;
+    }
+    SDL_UnlockMutex(cache->lock);
+}
+
+/*
+ * Stops the producer without dropping any frames, so that the scene can
+ * grow. Frames cached so far have to stay the same in the grown scene.
+ */
+static void
+panim_frame_cache_pause(PAnimFrameCache * cache)
+{
+    SDL_LockMutex(cache->lock);
+    cache->quit = true;
+    SDL_CondBroadcast(cache->changed);
+    SDL_UnlockMutex(cache->lock);
+    SDL_WaitThread(cache->thread, NULL);
+    cache->quit = false;
+}
+
+// Restarts the producer on the scene, which may have grown by `old_length`
+static void
+panim_frame_cache_resume(PAnimFrameCache * cache, size_t old_length)
+{
+    size_t length = cache->scene->length_in_frames;
+    if (length > old_length) {
+        cache->frames = (PAnimCachedFrame *) realloc(cache->frames, length * sizeof(PAnimCachedFrame));
+        if (!cache->frames) ERROR("out of memory!");
+        memset(cache->frames + old_length, 0, (length - old_length) * sizeof(PAnimCachedFrame));
+    }
+    
+    panim_scene_prepare_text(cache->scene);
+    panim_scene_clone_free(&cache->copy);
+    panim_scene_clone(&cache->copy, cache->scene);
+    
+    cache->thread = SDL_CreateThread(panim_frame_cache_producer, "PAnim Preview", cache);
+    if (!cache->thread) ERROR("failed to create thread!");
+}
+
+//
+// Streaming Scene Construction
+//
+
+typedef void PAnimSceneSetupFunc(PAnimScene * scene);
+typedef void PAnimSceneLoadFunc(PAnimEngine * pnm);
+typedef void PAnimSceneBuildFunc(PAnimScene * scene);
+
+#define PNM_STREAM_SLOTS 64
+
+/*
+ * Everything added to a scene between two calls to panim_scene_seal, copied,
+ * so nothing is shared with the scene code once it's handed over.
+ */
+typedef struct {
+    size_t sealed_frame; // PNM_FRAME_NEVER once the scene is complete
+    size_t length_in_frames;
+    PAnimCamera camera;
+    PAnimObject * records; // new objects, then new groups
+    PAnimObject ** sources; // where each record is in the scene being built
+    size_t object_count;
+    size_t group_count;
+    PAnimEvent * events;
+    size_t event_count;
+} PAnimSceneWindow;
+
+typedef struct {
+    PAnimObject * object;
+    size_t spawn_frame;
+    size_t despawn_frame;
+} PAnimDeclaredLifetime;
+
+/*
+ * Runs the scene code on a thread of its own, which hands each sealed window
+ * to the preview through a single-producer, single-consumer ring buffer. The
+ * preview adds them to its own copy of the scene, between frames. Neither
+ * side waits for the other, unless the ring is full. When the preview is
+ * closed early, the scene code is abandoned the next time it adds anything
+ * to the scene or seals.
+ */
+typedef struct PAnimSceneStream {
+    PAnimScene building; // only ever touched by the builder thread
+    PAnimSceneBuildFunc * build;
+    SDL_Thread * thread;
+    SDL_atomic_t quit;
+    jmp_buf abandon; // where the builder thread returns to once `quit` is set
+    
+    // Windows are written at `tail` by the builder, and read at `head`
+    PAnimSceneWindow * slots[PNM_STREAM_SLOTS];
+    SDL_atomic_t head;
+    SDL_atomic_t tail;
+    
+    // Builder side, how much of the scene was handed over already
+    size_t published_objects;
+    size_t published_groups;
+    size_t published_events;
+    
+    // Preview side
+    PAnimPtrMapping * map; // from the builder's objects to the preview's
+    PAnimDeclaredLifetime * lifetimes; // as they were before finalizing
+    bool done;
+} PAnimSceneStream;
+
+static void
+panim_scene_stream_publish(PAnimSceneStream * stream, size_t sealed_frame)
+{
+    PAnimScene *scene = &stream->building;
+    
+    // The preview takes windows out between frames
+    int tail = SDL_AtomicGet(&stream->tail);
+    while (tail - SDL_AtomicGet(&stream->head) == PNM_STREAM_SLOTS) {
+        if (SDL_AtomicGet(&stream->quit)) break;
+        SDL_Delay(1);
+    }
+    panim_scene_stream_poll(stream);
+    
+    PAnimSceneWindow *window = (PAnimSceneWindow *) calloc(1, sizeof(PAnimSceneWindow));
+    if (!window) ERROR("out of memory!");
+    window->sealed_frame = sealed_frame;
+    window->length_in_frames = scene->length_in_frames;
+    window->camera = scene->camera;
+    window->object_count = buf_len(scene->objects) - stream->published_objects;
+    window->group_count = buf_len(scene->groups) - stream->published_groups;
+    window->event_count = buf_len(scene->timeline) - stream->published_events;
+    
+    size_t record_count = window->object_count + window->group_count;
+    window->records = (PAnimObject *) malloc(MAX(1, record_count) * sizeof(PAnimObject));
+    window->sources = (PAnimObject **) malloc(MAX(1, record_count) * sizeof(PAnimObject *));
+    window->events = (PAnimEvent *) malloc(MAX(1, window->event_count) * sizeof(PAnimEvent));
+    if (!window->records || !window->sources || !window->events) ERROR("out of memory!");
+    
+    for (size_t i = 0; i < record_count; ++i) {
+        PAnimObject *obj = i < window->object_count
+            ? scene->objects[stream->published_objects + i]
+            : scene->groups[stream->published_groups + i - window->object_count];
+        window->records[i] = *obj;
+        window->sources[i] = obj;
+    }
+    if (window->event_count) {
+        memcpy(window->events, scene->timeline + stream->published_events,
+               window->event_count * sizeof(PAnimEvent));
+    }
+    
+    stream->published_objects = buf_len(scene->objects);
+    stream->published_groups = buf_len(scene->groups);
+    stream->published_events = buf_len(scene->timeline);
+    
+    stream->slots[tail % PNM_STREAM_SLOTS] = window;
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&stream->tail, tail + 1);
+}
+
+/*
+ * Promises that nothing added to the scene from here on changes any frame
+ * before `frame`: later events begin at `frame` or after it, objects in the
+ * scene stay as they are, and later objects only spawn at `frame`. When the
+ * scene is built for a streaming preview, everything added so far is handed
+ * to the preview, which can then show the frames before `frame`.
+ */
+static void
+panim_scene_seal(PAnimScene * scene, size_t frame)
+{
+    assert(frame >= scene->sealed_frame);
+    scene->sealed_frame = frame;
+    if (scene->stream) panim_scene_stream_publish(scene->stream, frame);
+}
+
+static int
+panim_scene_stream_builder(void * data)
+{
+    PAnimSceneStream *stream = (PAnimSceneStream *) data;
+    if (setjmp(stream->abandon) == 0) {
+        stream->build(&stream->building);
+        panim_scene_stream_publish(stream, PNM_FRAME_NEVER);
+    }
+    return 0;
+}
+
+/*
+ * Starts building a scene that was set up, but is still empty, on another
+ * thread. `scene` itself only grows through panim_scene_stream_receive.
+ */
+static void
+panim_scene_stream_start(PAnimSceneStream * stream, PAnimScene * scene,
+                         PAnimSceneBuildFunc * build)
+{
+    memset(stream, 0, sizeof(*stream));
+    stream->building = *scene;
+    stream->building.stream = stream;
+    stream->build = build;
+    scene->frame = PNM_FRAME_NEVER;
+    
+    buf_push(stream->map, (PAnimPtrMapping){
+        (uintptr_t)&stream->building.camera, sizeof(PAnimCamera), (char *)&scene->camera });
+    
+    stream->thread = SDL_CreateThread(panim_scene_stream_builder, "PAnim Scene", stream);
+    if (!stream->thread) ERROR("failed to create thread!");
+}
+
+static void
+panim_scene_window_free(PAnimSceneWindow * window)
+{
+    free(window->records);
+    free(window->sources);
+    free(window->events);
+    free(window);
+}
+
+static inline bool
+panim_scene_stream_pending(PAnimSceneStream * stream)
+{
+    return SDL_AtomicGet(&stream->head) != SDL_AtomicGet(&stream->tail);
+}
+
+/*
+ * Adds all windows sealed so far to `scene`, and finalizes it again. The
+ * scene ends at the last sealed frame, until it is complete.
+ */
+static void
+panim_scene_stream_receive(PAnimSceneStream * stream, PAnimScene * scene)
+{
+    int head = SDL_AtomicGet(&stream->head);
+    int tail = SDL_AtomicGet(&stream->tail);
+    SDL_MemoryBarrierAcquire();
+    if (head == tail) return;
+    
+    size_t sealed_frame = 0;
+    size_t length = 0;
+    for (; head != tail; ++head) {
+        PAnimSceneWindow *window = stream->slots[head % PNM_STREAM_SLOTS];
+        if (head == 0) scene->camera = window->camera;
+        
+        size_t record_count = window->object_count + window->group_count;
+        for (size_t i = 0; i < record_count; ++i) {
+            PAnimObject *obj = (PAnimObject *) panim_scene_alloc(scene, sizeof(PAnimObject));
+            *obj = window->records[i];
+            if (obj->type == PNM_OBJ_TEXT) {
+                obj->txt.data = (char *) panim_scene_alloc(scene, strlen(window->records[i].txt.data) + 1);
+                strcpy(obj->txt.data, window->records[i].txt.data);
+            }
+            
+            if (i < window->object_count) buf_push(scene->objects, obj);
+            else buf_push(scene->groups, obj);
+            buf_push(stream->map, (PAnimPtrMapping){
+                (uintptr_t)window->sources[i], sizeof(PAnimObject), (char *)obj });
+            buf_push(stream->lifetimes, (PAnimDeclaredLifetime){
+                obj, obj->spawn_frame, obj->despawn_frame });
+        }
+        buf_sort(stream->map, panim_ptr_mapping_sort);
+        
+        PAnimDeclaredLifetime *added = buf_end(stream->lifetimes) - record_count;
+        for (size_t i = 0; i < record_count; ++i) {
+            added[i].object->parent = (PAnimObject *) panim_ptr_remap(stream->map, added[i].object->parent);
+        }
+        
+        for (size_t i = 0; i < window->event_count; ++i) {
+            PAnimEvent anim = window->events[i];
+            switch (anim.type) {
+                case PNM_EVENT_COLOR_FADE: {
+                    anim.colfd.object = (PAnimObject *) panim_ptr_remap(stream->map, anim.colfd.object);
+                } break;
+                case PNM_EVENT_MOVEMENT: {
+                    anim.move.x_val = (int *) panim_ptr_remap(stream->map, anim.move.x_val);
+                    anim.move.y_val = (int *) panim_ptr_remap(stream->map, anim.move.y_val);
+                } break;
+                case PNM_EVENT_COLOCATE: {
+                    anim.copy_pos.src = (PAnimObject *) panim_ptr_remap(stream->map, anim.copy_pos.src);
+                    anim.copy_pos.dst = (PAnimObject *) panim_ptr_remap(stream->map, anim.copy_pos.dst);
+                } break;
+                case PNM_EVENT_TWEEN: {
+                    anim.tween.value = (float *) panim_ptr_remap(stream->map, anim.tween.value);
+                } break;
+                default: __debugbreak();
+            }
+            buf_push(scene->timeline, anim);
+        }
+        
+        sealed_frame = window->sealed_frame;
+        length = window->length_in_frames;
+        
+        panim_scene_window_free(window);
+        SDL_AtomicSet(&stream->head, head + 1);
+    }
+    
+    if (sealed_frame == PNM_FRAME_NEVER) stream->done = true;
+    scene->length_in_frames = stream->done ? length : MIN(sealed_frame, length);
+    
+    // Lifetimes are inferred from the whole timeline, which just grew
+    for (size_t i = 0; i < buf_len(stream->lifetimes); ++i) {
+        PAnimDeclaredLifetime *declared = stream->lifetimes + i;
+        declared->object->spawn_frame = declared->spawn_frame;
+        declared->object->despawn_frame = declared->despawn_frame;
+    }
+    panim_scene_finalize(scene);
+}
+
+/*
+ * Called whenever the scene code adds to the scene, so that it is abandoned
+ * soon after the preview is closed, even if it doesn't seal again for a while.
+ */
+static void
+panim_scene_stream_poll(PAnimSceneStream * stream)
+{
+    if (SDL_AtomicGet(&stream->quit)) longjmp(stream->abandon, 1);
+}
+
+/*
+ * Waits for the scene code to finish, or to add anything to the scene if it
+ * isn't done yet, as it's only ever abandoned there. Whatever it allocated
+ * itself in between is leaked.
+ */
+static void
+panim_scene_stream_stop(PAnimSceneStream * stream)
+{
+    SDL_AtomicSet(&stream->quit, 1);
+    SDL_WaitThread(stream->thread, NULL);
+    
+    int head = SDL_AtomicGet(&stream->head);
+    int tail = SDL_AtomicGet(&stream->tail);
+    for (; head != tail; ++head) panim_scene_window_free(stream->slots[head % PNM_STREAM_SLOTS]);
+    
+    panim_scene_destroy(&stream->building);
+    buf_free(stream->map);
+    buf_free(stream->lifetimes);
+}
+
+// Sleeps until the performance counter reaches `due`, spinning only for
+// the last millisecond, which SDL_Delay can't resolve
+static void
+panim_wait_until(Uint64 due)
+{
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    for (;;) {
+        Uint64 now = SDL_GetPerformanceCounter();
+        if (now >= due) break;
+        
+        Uint64 ms = (due - now) * 1000 / frequency;
+        if (ms > 1) SDL_Delay((Uint32)(ms - 1));
+    }
+}
+
+// Preview playback speeds, J and L step through them
+static const double panim_speeds[] = { 0.25, 0.5, 1, 2, 4, 8, 16, 32 };
+#define PNM_SPEED_NORMAL 2
+#define PNM_SPEED_COUNT (sizeof(panim_speeds) / sizeof(panim_speeds[0]))
+
+#define PNM_SCRUB_BAR_HEIGHT 8
+
+/*
+ * Draws the timeline along the bottom of the window, with the ranges that
+ * are cached and the current frame marked.
+ */
+static void
+panim_draw_scrub_bar(SDL_Renderer * renderer, int width, int height,
+                     bool * columns, int playhead_x)
+{
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    
+    SDL_Rect bar = { 0, height - PNM_SCRUB_BAR_HEIGHT, width, PNM_SCRUB_BAR_HEIGHT };
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0xA0);
+    SDL_RenderFillRect(renderer, &bar);
+    
+    SDL_SetRenderDrawColor(renderer, 0x80, 0x80, 0x80, 0xFF);
+    for (int x = 0; x < width;) {
+        if (!columns[x]) {
+            ++x;
+            continue;
+        }
+        
+        int end = x;
+        while (end < width && columns[end]) ++end;
+        SDL_Rect cached = { x, bar.y + 2, end - x, bar.h - 4 };
+        SDL_RenderFillRect(renderer, &cached);
+        x = end;
+    }
+    
+    SDL_Rect marker = { playhead_x - 1, bar.y, 3, bar.h };
+    SDL_SetRenderDrawColor(renderer, 0xFF, 0xFF, 0xFF, 0xFF);
+    SDL_RenderFillRect(renderer, &marker);
+}
+
+// Parses seconds, "minutes:seconds" or "hours:minutes:seconds" into a frame
+static size_t
+panim_parse_timestamp(const char * text)
+{
+    size_t seconds = 0;
+    for (const char *part = text; part; part = strchr(part, ':')) {
+        if (*part == ':') ++part;
+        seconds = seconds * 60 + (size_t) strtoul(part, NULL, 10);
+    }
+    return seconds * 60;
+}
+
+/*
+ * Preview playback state, which panim_host.c keeps across reloads.
+ */
+typedef struct {
+    double position; // in frames, fractional at slow speeds
+    size_t speed_index;
+    bool paused;
+    bool looping;
+    bool realtime;
+    bool reverse;
+    bool show_bar;
+    
+    // Polled a few times per second, if set
+    bool (*reload)(void * data);
+    void * reload_data;
+    
+    // Set while the scene is still being built, see PAnimSceneStream
+    PAnimSceneStream * stream;
+} PAnimPlayback;
+
+static inline PAnimPlayback
+panim_playback_default(void)
+{
+    PAnimPlayback playback = {0};
+    playback.speed_index = PNM_SPEED_NORMAL;
+    playback.show_bar = true;
+    return playback;
+}
+
+/* 
+* Plays back the scene in a preview window without rendering to a file,
+* showing frames rendered ahead by a PAnimFrameCache. Frames that were
+* already rendered can be replayed, looped and skipped to at no cost, and
+* the others are reached by seeking rather than playing up to them.
+* Checksums of each frame go to `manifest` the first time it is shown,
+* unless that's NULL.
+*
+* Frames are shown at exactly 60 per second, as in the video. By default,
+* playback waits for frames that aren't rendered yet, so every frame is
+* shown. In real-time mode, frames follow the clock instead, and any that
+* aren't ready in time are dropped. While paused, the preview sleeps until
+* there is input or the window needs to be redrawn, and frames that look like
+* the previous one aren't drawn.
+*
+* Controls: Space/K pause, J/L slower/faster, B reverse, comma/period step
+* a frame, arrow keys skip a second, Home/End jump to the start/end, O loop,
+* R real-time mode, T show/hide the timeline, which can be clicked and
+* dragged. Typing a timestamp like 1:30 and pressing Enter jumps there,
+* typing a number and pressing G jumps to that frame.
+*
+* Playback starts from, and leaves its state in, `playback`. If it has a
+* reload callback, the preview returns true as soon as that does. With a
+* stream, the scene grows whenever a new window is sealed, and playback
+* waits at its end until the scene is complete.
+*/
+static bool
+panim_scene_preview(PAnimEngine * pnm, PAnimScene * scene,
+                    PAnimManifest * manifest, PAnimPlayback * playback)
+{
+    if (!pnm->window) ERROR("no display available for the preview!");
+    
+    Uint32 next_poll = SDL_GetTicks();
+    PAnimSceneStream *stream = playback->stream;
+    size_t length = scene->length_in_frames;
+    while (length == 0) {
+        // Nothing to show but the empty window, until there is a scene
+        bool growing = stream && !stream->done;
+        if (!growing && !playback->reload) return false;
+        
+        SDL_WaitEventTimeout(NULL, growing ? 1 : 250);
+        SDL_Event event;
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT) return false;
+        }
+        if (playback->reload && playback->reload(playback->reload_data)) return true;
+        if (growing && panim_scene_stream_pending(stream)) {
+            panim_scene_stream_receive(stream, scene);
+            length = scene->length_in_frames;
+        }
+    }
+    
+    int width = scene->screen_width;
+    int height = scene->screen_height;
+    
+    PAnimFrameCache cache;
+    panim_frame_cache_start(&cache, pnm, scene, manifest != NULL);
+    
+    SDL_Texture *texture = SDL_CreateTexture(
+        pnm->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+        width, height);
+    if (!texture) ERROR("failed to create texture!");
+    Uint32 *pixels = (Uint32 *) malloc((size_t)width * height * sizeof(Uint32));
+    bool *columns = (bool *) calloc(width, sizeof(bool));
+    bool *shown_columns = (bool *) calloc(width, sizeof(bool));
+    if (!pixels || !columns || !shown_columns) ERROR("out of memory!");
+    
+    char title_buffer[1024];
+    char goto_buffer[32] = "";
+    SDL_StartTextInput();
+    
+    bool paused = playback->paused;
+    bool looping = playback->looping;
+    bool realtime = playback->realtime;
+    bool reverse = playback->reverse;
+    bool scrubbing = false;
+    bool show_bar = playback->show_bar;
+    bool reloading = false;
+    bool redraw = false; // the window was uncovered or resized
+    size_t speed_index = playback->speed_index;
+    double position = playback->position;
+    
+    uint64_t shown = 0; // hash of the frame on screen
+    size_t shown_frame = PNM_FRAME_NEVER;
+    int shown_bar_x = -1; // playhead on the timeline on screen, -1 if hidden
+    
+    // Frames are due at fixed offsets from when the clock was last reset,
+    // so that rounding errors don't add up over time
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    Uint64 clock_start = SDL_GetPerformanceCounter();
+    Uint64 clock_frames = 0;
+    double clock_position = 0; // where playback was when the clock was reset
+    bool reset_clock = true;
+    
+    for (bool running = true; running;) {
+        SDL_Event event;
+        while (SDL_PollEvent(&event)) {
+            size_t goto_len = strlen(goto_buffer);
+            size_t t = (size_t) position;
+            
+            if (event.type == SDL_QUIT) running = false;
+            if (event.type == SDL_WINDOWEVENT &&
+                (event.window.event == SDL_WINDOWEVENT_EXPOSED ||
+                 event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED))
+            {
+                redraw = true;
+            }
+            if (event.type == SDL_KEYUP) switch (event.key.keysym.sym) {
+                case SDLK_ESCAPE: {
+                    if (goto_len) goto_buffer[0] = 0;
+                    else running = false;
+                } break;
+                case SDLK_SPACE: case 'k': {
+                    paused = !paused;
+                } break;
+                case 'l': {
+                    if (speed_index + 1 < PNM_SPEED_COUNT)
+                        speed_index += 1;
+                } break;
+                case 'j': {
+                    if (speed_index > 0)
+                        speed_index -= 1;
+                } break;
+                case 'b': {
+                    reverse = !reverse;
+                } break;
+                case 'o': {
+                    looping = !looping;
+                } break;
+                case 'r': {
+                    realtime = !realtime;
+                } break;
+                case 't': {
+                    show_bar = !show_bar;
+                } break;
+                case SDLK_COMMA: {
+                    paused = true;
+                    position = (double)(t > 0 ? t - 1 : 0);
+                } break;
+                case SDLK_PERIOD: {
+                    paused = true;
+                    position = (double) MIN(t + 1, length - 1);
+                } break;
+                case SDLK_LEFT: {
+                    position = (double)(t > 60 ? t - 60 : 0);
+                } break;
+                case SDLK_RIGHT: {
+                    position = (double) MIN(t + 60, length - 1);
+                } break;
+                case SDLK_HOME: {
+                    position = 0;
+                    paused = false;
+                } break;
+                case SDLK_END: {
+                    position = (double)(length - 1);
+                } break;
+                case SDLK_BACKSPACE: {
+                    if (goto_len) goto_buffer[goto_len - 1] = 0;
+                } break;
+                case SDLK_RETURN: case SDLK_KP_ENTER: case 'g': {
+                    if (!goto_len) break;
+                    size_t target = event.key.keysym.sym == 'g'
+                        ? (size_t) strtoull(goto_buffer, NULL, 10)
+                        : panim_parse_timestamp(goto_buffer);
+                    position = (double) MIN(target, length - 1);
+                    goto_buffer[0] = 0;
+                } break;
+            }
+            
+            // Typed characters, as which key gives a colon depends on the layout
+            if (event.type == SDL_TEXTINPUT) {
+                for (char *c = event.text.text; *c; ++c) {
+                    bool digit = *c >= '0' && *c <= '9';
+                    if ((digit || *c == ':') && goto_len + 1 < sizeof(goto_buffer)) {
+                        goto_buffer[goto_len++] = *c;
+                        goto_buffer[goto_len] = 0;
+                    }
+                }
+            }
+            
+            if (event.type == SDL_MOUSEBUTTONDOWN && show_bar &&
+                event.button.button == SDL_BUTTON_LEFT &&
+                event.button.y >= height - 3 * PNM_SCRUB_BAR_HEIGHT)
+            {
+                scrubbing = true;
+            }
+            if (event.type == SDL_MOUSEBUTTONUP) scrubbing = false;
+            if (scrubbing && (event.type == SDL_MOUSEBUTTONDOWN || event.type == SDL_MOUSEMOTION)) {
+                int x = event.type == SDL_MOUSEMOTION ? event.motion.x : event.button.x;
+                x = x < 0 ? 0 : MIN(x, width - 1);
+                position = (double)((size_t) x * length / width);
+            }
+            
+            if (event.type == SDL_KEYUP || event.type == SDL_MOUSEBUTTONDOWN ||
+                event.type == SDL_MOUSEBUTTONUP || scrubbing)
+            {
+                reset_clock = true;
+            }
+        }
+        if (!running) break;
         
-        packet->stream_index = stream->index;
-        if (packet->pts != AV_NOPTS_VALUE)
-            packet->pts = av_rescale_q(packet->pts, cdc_ctx->time_base, stream->time_base);
-        if (packet->dts != AV_NOPTS_VALUE)
-            packet->dts = av_rescale_q(packet->dts, cdc_ctx->time_base, stream->time_base);
+        if (playback->reload && SDL_TICKS_PASSED(SDL_GetTicks(), next_poll)) {
+            next_poll = SDL_GetTicks() + 250;
+            if (playback->reload(playback->reload_data)) {
+                reloading = true;
+                break;
+            }
+        }
         
-        if (av_write_frame(fmt_ctx, packet) < 0) {
-            ERROR("failed to write frame to stream");
+        if (stream && panim_scene_stream_pending(stream)) {
+            panim_frame_cache_pause(&cache);
+            panim_scene_stream_receive(stream, scene);
+            panim_frame_cache_resume(&cache, length);
+            length = scene->length_in_frames;
         }
+        bool growing = stream && !stream->done;
         
-        av_packet_unref(packet);
+        bool playing = !paused && !scrubbing;
+        double speed = panim_speeds[speed_index];
+        if (reset_clock) {
+            clock_start = SDL_GetPerformanceCounter();
+            clock_frames = 0;
+            clock_position = position;
+            reset_clock = false;
+        }
+        
+        if (realtime && playing) {
+            double elapsed = (double)(SDL_GetPerformanceCounter() - clock_start) * 60 / frequency;
+            position = clock_position + (reverse ? -elapsed : elapsed) * speed;
+        }
+        if (position >= (double) length || position < 0) {
+            bool forward = position >= (double) length;
+            if (forward && growing) {
+                // Waits for more of the scene, as if buffering
+                position = (double)(length - 1);
+                reset_clock = true;
+            } else if (looping) {
+                position = forward ? 0 : (double)(length - 1);
+                reset_clock = true;
+            } else {
+                position = forward ? (double)(length - 1) : 0;
+                paused = true;
+            }
+        }
+        
+        size_t t = (size_t) position;
+        size_t stride = playing && speed > 1 ? (size_t) speed : 1;
+        panim_frame_cache_seek(&cache, t, stride, reverse);
+        
+        int bar_x = -1;
+        bool bar_changed = false;
+        if (show_bar) {
+            bar_x = (int)(t * width / length);
+            panim_frame_cache_columns(&cache, columns, width);
+            bar_changed = memcmp(columns, shown_columns, width * sizeof(bool)) != 0;
+        }
+        bar_changed = bar_changed || bar_x != shown_bar_x;
+        
+        // Nothing changes on screen until there is input, except for the
+        // cached ranges on the timeline
+        if (!playing && shown_frame == t && !bar_changed && !redraw) {
+            if (growing) SDL_WaitEventTimeout(NULL, 10);
+            else if (show_bar || playback->reload) SDL_WaitEventTimeout(NULL, 250);
+            else SDL_WaitEvent(NULL);
+            continue;
+        }
+        
+        PAnimCachedFrame frame;
+        bool ready = panim_frame_cache_get(&cache, t, pixels, shown, &frame);
+        snprintf(title_buffer, 1024, "PAnim - Preview (%zd / %zd) %gx%s%s%s%s%s%s%s",
+                 t, length, speed, reverse ? " Reverse" : "",
+                 ready ? "" : " - Buffering", growing ? " - Building" : "",
+                 realtime ? " - Real-Time" : "", looping ? " - Looping" : "",
+                 goto_buffer[0] ? " - Go to: " : "", goto_buffer);
+        panim_engine_set_title(pnm, title_buffer);
+        
+        if (!ready) {
+            // Frames are only dropped in real-time mode, otherwise time stops
+            panim_frame_cache_wait(&cache, t, 10);
+            if (!realtime) reset_clock = true;
+            continue;
+        }
+        
+        if (manifest && (manifest->last_frame == PNM_FRAME_NEVER || t > manifest->last_frame)) {
+            panim_manifest_write(manifest, t, frame.pixels_hash, frame.state_hash);
+        }
+        
+        if (frame.data_hash != shown || bar_changed || redraw) {
+            if (frame.data_hash != shown) {
+                SDL_UpdateTexture(texture, NULL, pixels, width * sizeof(Uint32));
+            }
+            SDL_RenderCopy(pnm->renderer, texture, NULL, NULL);
+            if (show_bar) panim_draw_scrub_bar(pnm->renderer, width, height, columns, bar_x);
+            SDL_RenderPresent(pnm->renderer);
+            
+            shown = frame.data_hash;
+            shown_bar_x = bar_x;
+            redraw = false;
+            memcpy(shown_columns, columns, width * sizeof(bool));
+        }
+        shown_frame = t;
+        
+        // Stops on the last frame, so it can still be replayed
+        if (!realtime && playing) position += reverse ? -speed : speed;
+        
+        if (realtime) {
+            clock_frames = (SDL_GetPerformanceCounter() - clock_start) * 60 / frequency + 1;
+        } else {
+            clock_frames += 1;
+        }
+        
+        // Slow down rather than rushing through frames to catch up
+        Uint64 due = clock_start + clock_frames * frequency / 60;
+        if (!realtime && SDL_GetPerformanceCounter() > due + frequency / 60) {
+            reset_clock = true;
+        } else {
+            panim_wait_until(due);
+        }
+    }
+    
+    SDL_StopTextInput();
+    panim_frame_cache_stop(&cache);
+    SDL_DestroyTexture(texture);
+    free(pixels);
+    free(columns);
+    free(shown_columns);
+    
+    playback->paused = paused;
+    playback->looping = looping;
+    playback->realtime = realtime;
+    playback->reverse = reverse;
+    playback->show_bar = show_bar;
+    playback->speed_index = speed_index;
+    playback->position = position;
+    return reloading;
+}
+
+static void
+panim_scene_play(PAnimEngine * pnm, PAnimScene * scene, PAnimManifest * manifest)
+{
+    PAnimPlayback playback = panim_playback_default();
+    panim_scene_preview(pnm, scene, manifest, &playback);
+    panim_scene_destroy(scene);
+    panim_engine_end_preview(pnm);
+}
+
+typedef struct {
+    char command[4096];
+    int result;
+} PAnimSegmentJob;
+
+static int
+panim_segment_process(void * data)
+{
+    PAnimSegmentJob *job = (PAnimSegmentJob *) data;
+    job->result = system(job->command);
+    return 0;
+}
+
+static bool
+panim_file_exists(const char * filename)
+{
+    FILE *file = fopen(filename, "rb");
+    if (file) fclose(file);
+    return file != NULL;
+}
+
+/*
+ * Splits the scene into `segment_count` GOP-aligned frame ranges, renders
+ * each in a separate process running this executable with --from/--to,
+ * all at once, then stitches the results. Each segment is only renamed to
+ * its final name once its process has succeeded, and segments that
+ * already exist are not rendered again, so rerunning after a crash only
+ * redoes the segments that didn't finish.
+ */
+static int
+panim_render_segments(char * executable, PAnimScene * scene, char * filename,
+                      int segment_count, int jobs)
+{
+    size_t length = scene->length_in_frames;
+    size_t per_segment = (length + segment_count - 1) / segment_count;
+    per_segment = MAX(1, (per_segment + PNM_GOP_SIZE - 1) / PNM_GOP_SIZE) * PNM_GOP_SIZE;
+    size_t count = (length + per_segment - 1) / per_segment;
+    
+    char **parts = NULL;
+    PAnimSegmentJob *segment_jobs = (PAnimSegmentJob *) calloc(MAX(1, count), sizeof(PAnimSegmentJob));
+    SDL_Thread **threads = (SDL_Thread **) calloc(MAX(1, count), sizeof(SDL_Thread *));
+    
+    for (size_t i = 0; i < count; ++i) {
+        size_t from = i * per_segment;
+        size_t to = MIN(length, from + per_segment);
+        
+        char *part = (char *) malloc(1024);
+        snprintf(part, 1024, "%s.part%zu.mp4", filename, i);
+        buf_push(parts, part);
+        if (panim_file_exists(part)) continue;
+        
+        // cmd.exe strips the outermost quotes of the whole command line
+#ifdef _WIN32
+        const char *format = "\"\"%s\" --jobs %d --from %zu --to %zu \"%s.tmp\"\"";
+#else
+        const char *format = "\"%s\" --jobs %d --from %zu --to %zu \"%s.tmp\"";
+#endif
+        snprintf(segment_jobs[i].command, sizeof(segment_jobs[i].command),
+                 format, executable, jobs, from, to, part);
+        
+        threads[i] = SDL_CreateThread(panim_segment_process, "PAnim Segment", segment_jobs + i);
+        if (!threads[i]) ERROR("failed to create thread!");
+    }
+    
+    int failed = 0;
+    char temp_name[1024];
+    for (size_t i = 0; i < count; ++i) {
+        if (!threads[i]) continue;
+        SDL_WaitThread(threads[i], NULL);
+        
+        snprintf(temp_name, 1024, "%s.tmp", parts[i]);
+        if (segment_jobs[i].result != 0 || rename(temp_name, parts[i]) != 0) {
+            fprintf(stderr, "Error: segment %zu (frames %zu to %zu) failed, run again to retry it\n",
+                    i, i * per_segment, MIN(length, (i + 1) * per_segment));
+            ++failed;
+        }
+    }
+    
+    if (!failed) {
+        panim_stitch(filename, parts, count);
+        for (size_t i = 0; i < count; ++i) remove(parts[i]);
+    }
+    
+    for (size_t i = 0; i < count; ++i) free(parts[i]);
+    buf_free(parts);
+    free(segment_jobs);
+    free(threads);
+    return failed ? 1 : 0;
+}
+
+// Bump when changing anything about how segments are encoded
+#define PNM_CACHE_VERSION 1
+
+/*
+ * Hashes the frames of each GOP-sized segment of a finalized, not yet
+ * updated scene, by playing back a copy of it without drawing anything.
+ * Text has to be prepared beforehand, so the copy shares its surfaces.
+ */
+static uint64_t *
+panim_scene_segment_hashes(PAnimEngine * pnm, PAnimScene * scene)
+{
+    PAnimScene copy;
+    panim_scene_clone(&copy, scene);
+    
+    uint64_t *hashes = NULL;
+    uint64_t *words = NULL;
+    for (size_t from = 0; from < scene->length_in_frames; from += PNM_GOP_SIZE) {
+        size_t to = MIN(scene->length_in_frames, from + PNM_GOP_SIZE);
+        if (from % PNM_RETIRE_INTERVAL == 0) panim_scene_retire(&copy, false);
+        
+        buf_clear(words);
+        buf_push(words, (uint64_t) PNM_CACHE_VERSION);
+        buf_push(words, panim_pack32(pnm->backend, (int)(to - from)));
+        buf_push(words, panim_pack32(scene->screen_width, scene->screen_height));
+        for (size_t t = from; t < to; ++t) {
+            panim_scene_seek(&copy, t);
+            buf_push(words, (uint64_t)(t - from));
+            panim_frame_state_words(pnm, &copy, &words);
+        }
+        
+        buf_push(hashes, panim_hash64(words, buf_sizeof(words), 0));
+    }
+    
+    buf_free(words);
+    panim_scene_clone_free(&copy);
+    return hashes;
+}
+
+/*
+ * Renders the whole scene to a file one GOP-sized segment at a time,
+ * keeping each encoded segment in `cache_dir`, named after a hash of what
+ * its frames show. Segments already in the cache are copied rather than
+ * rendered again, so after an edit only the segments that actually look
+ * different are, wherever they are in the scene. The cache is never
+ * cleaned up; deleting the directory is always safe.
+ */
+static void
+panim_scene_render_cached(PAnimEngine * pnm, PAnimScene * scene, char * filename,
+                          char * cache_dir, int jobs)
+{
+    PNM_MKDIR(cache_dir); // fails harmlessly if it already exists
+    
+    panim_scene_prepare_text(scene);
+    uint64_t *hashes = panim_scene_segment_hashes(pnm, scene);
+    size_t count = buf_len(hashes);
+    if (!count) ERROR("nothing to render!");
+    
+    char **parts = NULL;
+    size_t reused = 0;
+    char temp_name[1024];
+    for (size_t i = 0; i < count; ++i) {
+        size_t from = i * PNM_GOP_SIZE;
+        size_t to = MIN(scene->length_in_frames, from + PNM_GOP_SIZE);
+        
+        char *part = (char *) malloc(1024);
+        snprintf(part, 1024, "%s/%016llx.mp4", cache_dir, (unsigned long long) hashes[i]);
+        buf_push(parts, part);
+        if (panim_file_exists(part)) {
+            reused += 1;
+            continue;
+        }
+        
+        // Parallel renders work on copies, leaving the scene itself unplayed
+        snprintf(temp_name, 1024, "%s.tmp", part);
+        if (jobs > 0) {
+            panim_scene_render_parallel(pnm, scene, temp_name, from, to, jobs, NULL);
+        } else {
+            panim_scene_render(pnm, scene, temp_name, from, to, NULL);
+        }
+        if (rename(temp_name, part) != 0) ERROR("failed to move segment into the cache!");
+    }
+    
+    printf("Reused %zu of %zu segments from the cache\n", reused, count);
+    panim_stitch(filename, parts, count);
+    
+    for (size_t i = 0; i < count; ++i) free(parts[i]);
+    buf_free(parts);
+    buf_free(hashes);
+}
+
+//
+// Algorithm Traces
+//
+
+static inline bool
+panim_trace_before(PAnimTraceRecord * a, PAnimTraceRecord * b)
+{
+    return a->time < b->time || (a->time == b->time && a->thread < b->thread);
+}
+
+// Restores the heap property below `i`, for threads keyed by their next record
+static void
+panim_trace_sift_down(size_t * heap, size_t heap_len, size_t i,
+                      PAnimTraceRecord * split, size_t * cursors)
+{
+    for (;;) {
+        size_t first = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        if (left < heap_len &&
+            panim_trace_before(split + cursors[heap[left]], split + cursors[heap[first]])) {
+            first = left;
+        }
+        if (right < heap_len &&
+            panim_trace_before(split + cursors[heap[right]], split + cursors[heap[first]])) {
+            first = right;
+        }
+        if (first == i) break;
+        
+        size_t tmp = heap[i];
+        heap[i] = heap[first];
+        heap[first] = tmp;
+        i = first;
+    }
+}
+
+/*
+ * Merges the threads of a trace into a single stream, in the order things
+ * happened. The writer interleaves threads block by block, but each thread's
+ * records are in the order it recorded them, which the merge keeps, even if
+ * the thread's clock went backwards while it moved between cores.
+ */
+static void
+panim_trace_merge(PAnimTraceRecord * records)
+{
+    size_t count = buf_len(records);
+    if (count == 0) return;
+    
+    size_t thread_count = 0;
+    for (size_t i = 0; i < count; ++i) {
+        thread_count = MAX(thread_count, (size_t) records[i].thread + 1);
+    }
+    
+    // Splitting by thread first, keeping the order within each
+    size_t *starts = (size_t *) calloc(thread_count + 1, sizeof(size_t));
+    size_t *cursors = (size_t *) malloc(thread_count * sizeof(size_t));
+    size_t *heap = (size_t *) malloc(thread_count * sizeof(size_t));
+    PAnimTraceRecord *split = (PAnimTraceRecord *) malloc(count * sizeof(PAnimTraceRecord));
+    if (!starts || !cursors || !heap || !split) ERROR("out of memory!");
+    
+    for (size_t i = 0; i < count; ++i) starts[records[i].thread + 1] += 1;
+    for (size_t t = 0; t < thread_count; ++t) starts[t + 1] += starts[t];
+    memcpy(cursors, starts, thread_count * sizeof(size_t));
+    for (size_t i = 0; i < count; ++i) split[cursors[records[i].thread]++] = records[i];
+    memcpy(cursors, starts, thread_count * sizeof(size_t));
+    
+    size_t heap_len = 0;
+    for (size_t t = 0; t < thread_count; ++t) {
+        for (size_t i = starts[t] + 1; i < starts[t + 1]; ++i) {
+            split[i].time = MAX(split[i].time, split[i - 1].time);
+        }
+        if (starts[t] < starts[t + 1]) heap[heap_len++] = t;
+    }
+    for (size_t i = heap_len / 2; i-- > 0;) {
+        panim_trace_sift_down(heap, heap_len, i, split, cursors);
+    }
+    
+    for (size_t i = 0; i < count; ++i) {
+        size_t t = heap[0];
+        records[i] = split[cursors[t]++];
+        if (cursors[t] == starts[t + 1]) heap[0] = heap[--heap_len];
+        panim_trace_sift_down(heap, heap_len, 0, split, cursors);
+    }
+    
+    free(split);
+    free(heap);
+    free(cursors);
+    free(starts);
+}
+
+/*
+ * Reads a trace recorded with panim_trace.h, returning all of its records
+ * in a stretchy buffer, with all threads merged by time.
+ */
+static PAnimTraceRecord *
+panim_trace_load(const char * filename)
+{
+    FILE *file = fopen(filename, "rb");
+    if (!file) ERROR("failed to open trace file!");
+    
+    PAnimTraceHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, PNM_TRACE_MAGIC, sizeof(header.magic)) != 0) {
+        ERROR("not a trace file!");
+    }
+    if (header.version != PNM_TRACE_VERSION || header.record_size != sizeof(PAnimTraceRecord)) {
+        ERROR("trace was recorded by a different version of PAnim!");
+    }
+    
+    PAnimTraceRecord *records = NULL;
+    for (;;) {
+        buf_fit(records, buf_len(records) + PNM_TRACE_BLOCK_RECORDS);
+        size_t count = fread(buf_end(records), sizeof(PAnimTraceRecord),
+                             PNM_TRACE_BLOCK_RECORDS, file);
+        buf__hdr(records)->len += count;
+        if (count < PNM_TRACE_BLOCK_RECORDS) break;
+    }
+    
+    fclose(file);
+    panim_trace_merge(records);
+    return records;
+}
+
+// Index of the first record marked with `id`, or PNM_FRAME_NEVER
+static size_t
+panim_trace_find_mark(PAnimTraceRecord * trace, size_t id)
+{
+    for (size_t i = 0; i < buf_len(trace); ++i) {
+        if (trace[i].op == PNM_TRACE_MARK && trace[i].index == id) return i;
+    }
+    return PNM_FRAME_NEVER;
+}
+
+/*
+ * How panim_trace_build lays out arrays: each array is a row of bars, side
+ * by side in the order of their elements, the row of array `a` standing on
+ * y + a * row_spacing. Only elements [first, first + count) get bars; if
+ * count is zero, only those the window reads, writes, compares or swaps.
+ * With a lane width, each thread also gets a lane, where every record shows
+ * up as a tick, placed by the time it was recorded at.
+ */
+typedef struct {
+    int x, y;
+    int spacing; // between the bars of an array
+    int row_spacing;
+    size_t first; // of the elements with bars, all arrays alike
+    size_t count; // zero to pick them from the window
+    float scale; // bar height per unit of value
+    float width;
+    SDL_Color color;
+    SDL_Color highlight; // for reads and comparisons
+    size_t step; // frames per record
+    
+    int lane_x, lane_y;
+    int lane_width; // no lanes if zero
+    int lane_spacing;
+    
+    // Highlights are in the color of the thread that recorded them, if set
+    const SDL_Color * thread_colors;
+    int thread_color_count;
+} PAnimTraceLayout;
+
+typedef struct {
+    int64_t * values;
+    size_t * shown; // elements that get bars, ascending
+    PAnimObject ** bars; // by position, for those of `shown` within the array
+} PAnimTraceArray;
+
+static int
+panim_trace_index_sort(const size_t * a, const size_t * b)
+{
+    if (*a < *b) return -1;
+    if (*a > *b) return  1;
+    return 0;
+}
+
+static void
+panim_trace_array_alloc(PAnimTraceArray * array, size_t count)
+{
+    size_t bar_count = 0;
+    while (bar_count < buf_len(array->shown) && array->shown[bar_count] < count) ++bar_count;
+    
+    buf_clear(array->values);
+    buf_clear(array->bars);
+    buf_fit(array->values, count);
+    buf_fit(array->bars, bar_count);
+    for (size_t i = 0; i < count; ++i) buf_push(array->values, 0);
+    for (size_t i = 0; i < bar_count; ++i) buf_push(array->bars, NULL);
+}
+
+// The bar of element `index`, NULL if it has none
+static PAnimObject **
+panim_trace_bar_at(PAnimTraceArray * array, size_t index)
+{
+    size_t lo = 0, hi = buf_len(array->bars);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (array->shown[mid] < index) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == buf_len(array->bars) || array->shown[lo] != index) return NULL;
+    return array->bars + lo;
+}
+
+static PAnimTraceArray *
+panim_trace_array_at(PAnimTraceArray * arrays, PAnimTraceRecord * record, size_t index)
+{
+    PAnimTraceArray *array = arrays + record->array;
+    if (index >= buf_len(array->values)) ERROR("trace accesses an array out of bounds!");
+    return array;
+}
+
+// Adds the bar at `position` from the left of the row
+static PAnimObject *
+panim_trace_add_bar(PAnimScene * scene, PAnimTraceLayout * layout,
+                    int array, size_t position, int64_t value, SDL_Color color)
+{
+    PAnimObject *group = panim_scene_add_group(
+        scene, NULL, layout->x + (int) position * layout->spacing,
+        layout->y + array * layout->row_spacing);
+    PAnimObject *bar = panim_scene_add_line(
+        scene, color, 0, 0, 0, -(int)((float) value * layout->scale), 0);
+    panim_line_set_style(bar, layout->width, PNM_LINE_CAP_BUTT);
+    panim_object_set_parent(bar, group, false);
+    return bar;
+}
+
+static SDL_Color
+panim_trace_thread_color(PAnimTraceLayout * layout, int thread)
+{
+    if (!layout->thread_colors) return layout->highlight;
+    return layout->thread_colors[thread % layout->thread_color_count];
+}
+
+static void
+panim_trace_flash(PAnimScene * scene, PAnimTraceLayout * layout,
+                  PAnimObject * bar, SDL_Color color, size_t begin_frame)
+{
+    size_t half = layout->step / 2;
+    panim_scene_add_fade(scene, bar, color, begin_frame, half);
+    panim_scene_add_fade(scene, bar, layout->color, begin_frame + half, layout->step - half);
+}
+
+/*
+ * Animates records [from, to) of a trace, one every `layout->step` frames
+ * starting at `begin_frame`, and returns the frame after the last one.
+ * Records before the window are only replayed to know what the arrays hold
+ * when it starts, so windows can be anywhere in traces of any length.
+ * Elements chosen by the layout become bars, which swaps move,
+ * writes resize, and reads and comparisons light up; the others are only
+ * kept track of, so arrays of millions of elements cost no more to show.
+ */
+static size_t
+panim_trace_build(PAnimScene * scene, PAnimTraceRecord * trace,
+                  size_t from, size_t to, PAnimTraceLayout * layout,
+                  size_t begin_frame)
+{
+    if (to > buf_len(trace)) to = buf_len(trace);
+    
+    PAnimTraceArray arrays[256] = {0};
+    if (layout->count) {
+        for (int a = 0; a < 256; ++a) {
+            buf_fit(arrays[a].shown, layout->count);
+            for (size_t i = 0; i < layout->count; ++i) buf_push(arrays[a].shown, layout->first + i);
+        }
+    } else {
+        for (size_t r = from; r < to; ++r) {
+            PAnimTraceRecord *record = trace + r;
+            PAnimTraceArray *array = arrays + record->array;
+            switch (record->op) {
+                case PNM_TRACE_READ: case PNM_TRACE_WRITE: {
+                    buf_push(array->shown, record->index);
+                } break;
+                case PNM_TRACE_COMPARE: case PNM_TRACE_SWAP: {
+                    buf_push(array->shown, record->index);
+                    buf_push(array->shown, (size_t) record->value);
+                } break;
+                default: break;
+            }
+        }
+        for (int a = 0; a < 256; ++a) {
+            size_t *shown = arrays[a].shown;
+            buf_sort(shown, panim_trace_index_sort);
+            size_t unique = 0;
+            for (size_t i = 0; i < buf_len(shown); ++i) {
+                if (unique == 0 || shown[i] != shown[unique - 1]) shown[unique++] = shown[i];
+            }
+            if (shown) buf__hdr(shown)->len = unique;
+        }
+    }
+    
+    for (size_t r = 0; r < from && r < to; ++r) {
+        PAnimTraceRecord *record = trace + r;
+        PAnimTraceArray *array = arrays + record->array;
+        switch (record->op) {
+            case PNM_TRACE_ALLOC: {
+                panim_trace_array_alloc(array, (size_t) record->value);
+            } break;
+            case PNM_TRACE_WRITE: {
+                panim_trace_array_at(arrays, record, record->index);
+                array->values[record->index] = record->value;
+            } break;
+            case PNM_TRACE_SWAP: {
+                size_t i = record->index, j = (size_t) record->value;
+                panim_trace_array_at(arrays, record, MAX(i, j));
+                int64_t tmp = array->values[i];
+                array->values[i] = array->values[j];
+                array->values[j] = tmp;
+            } break;
+            default: break;
+        }
+    }
+    
+    for (int a = 0; a < 256; ++a) {
+        PAnimTraceArray *array = arrays + a;
+        for (size_t i = 0; i < buf_len(array->bars); ++i) {
+            array->bars[i] = panim_trace_add_bar(
+                scene, layout, a, i, array->values[array->shown[i]], layout->color);
+        }
+    }
+    
+    // Lanes span the time from the first record of the window to the last
+    uint64_t time_begin = 0;
+    uint64_t time_span = 1;
+    if (layout->lane_width > 0 && from < to) {
+        int lane_count = 0;
+        for (size_t r = from; r < to; ++r) lane_count = MAX(lane_count, trace[r].thread + 1);
+        
+        SDL_Color track = layout->color;
+        track.a = 0x40;
+        for (int i = 0; i < lane_count; ++i) {
+            int y = layout->lane_y + i * layout->lane_spacing;
+            panim_scene_add_line(scene, track, layout->lane_x, y,
+                                 layout->lane_x + layout->lane_width, y, 0);
+        }
+        
+        time_begin = trace[from].time;
+        time_span = MAX(1, trace[to - 1].time - time_begin);
+    }
+    
+    size_t t = begin_frame;
+    for (size_t r = from; r < to; ++r) {
+        PAnimTraceRecord *record = trace + r;
+        PAnimTraceArray *array = arrays + record->array;
+        SDL_Color color = panim_trace_thread_color(layout, record->thread);
+        switch (record->op) {
+            case PNM_TRACE_ALLOC: {
+                for (size_t i = 0; i < buf_len(array->bars); ++i) {
+                    SDL_Color gone = array->bars[i]->color;
+                    gone.a = 0;
+                    panim_scene_add_fade(scene, array->bars[i], gone, t, layout->step);
+                }
+                
+                panim_trace_array_alloc(array, (size_t) record->value);
+                SDL_Color hidden = layout->color;
+                hidden.a = 0;
+                for (size_t i = 0; i < buf_len(array->bars); ++i) {
+                    array->bars[i] = panim_trace_add_bar(scene, layout, record->array, i, 0, hidden);
+                    panim_scene_add_fade(scene, array->bars[i], layout->color, t, layout->step);
+                }
+            } break;
+            case PNM_TRACE_READ: {
+                panim_trace_array_at(arrays, record, record->index);
+                PAnimObject **bar = panim_trace_bar_at(array, record->index);
+                if (bar) panim_trace_flash(scene, layout, *bar, color, t);
+            } break;
+            case PNM_TRACE_WRITE: {
+                panim_trace_array_at(arrays, record, record->index);
+                PAnimObject **bar = panim_trace_bar_at(array, record->index);
+                if (bar) panim_scene_add_move(scene, &(*bar)->line.x2, &(*bar)->line.y2,
+                                              0, -(int)((float) record->value * layout->scale),
+                                              false, t, layout->step);
+                array->values[record->index] = record->value;
+            } break;
+            case PNM_TRACE_COMPARE: {
+                size_t i = record->index, j = (size_t) record->value;
+                panim_trace_array_at(arrays, record, MAX(i, j));
+                PAnimObject **bar_i = panim_trace_bar_at(array, i);
+                PAnimObject **bar_j = panim_trace_bar_at(array, j);
+                if (bar_i) panim_trace_flash(scene, layout, *bar_i, color, t);
+                if (bar_j) panim_trace_flash(scene, layout, *bar_j, color, t);
+            } break;
+            case PNM_TRACE_SWAP: {
+                size_t i = record->index, j = (size_t) record->value;
+                panim_trace_array_at(arrays, record, MAX(i, j));
+                PAnimObject **bar_i = panim_trace_bar_at(array, i);
+                PAnimObject **bar_j = panim_trace_bar_at(array, j);
+                if (bar_i && bar_j) {
+                    int distance = (int)(bar_j - bar_i) * layout->spacing;
+                    panim_move_group(scene, (*bar_i)->parent, distance, 0, true, t, layout->step);
+                    panim_move_group(scene, (*bar_j)->parent, -distance, 0, true, t, layout->step);
+                    PAnimObject *tmp = *bar_i;
+                    *bar_i = *bar_j;
+                    *bar_j = tmp;
+                } else if (bar_i || bar_j) {
+                    // Swapping with an element without a bar only changes the one bar
+                    PAnimObject *bar = bar_i ? *bar_i : *bar_j;
+                    int64_t value = bar_i ? array->values[j] : array->values[i];
+                    panim_scene_add_move(scene, &bar->line.x2, &bar->line.y2,
+                                         0, -(int)((float) value * layout->scale),
+                                         false, t, layout->step);
+                }
+                
+                int64_t tmp = array->values[i];
+                array->values[i] = array->values[j];
+                array->values[j] = tmp;
+            } break;
+            default: continue; // marks take no time
+        }
+        
+        if (layout->lane_width > 0) {
+            int x = layout->lane_x + (int)((double)(record->time - time_begin) *
+                                           layout->lane_width / (double) time_span);
+            int y = layout->lane_y + record->thread * layout->lane_spacing;
+            SDL_Color hidden = color;
+            hidden.a = 0;
+            PAnimObject *tick = panim_scene_add_line(
+                scene, hidden, x, y - layout->lane_spacing / 4, x, y + layout->lane_spacing / 4, 1);
+            panim_scene_add_fade(scene, tick, color, t, layout->step);
+        }
+        t += layout->step;
+    }
+    
+    for (int a = 0; a < 256; ++a) {
+        buf_free(arrays[a].values);
+        buf_free(arrays[a].shown);
+        buf_free(arrays[a].bars);
+    }
+    return t;
+}
+
+//
+// Compiled Scenes
+//
+
+// A finalized scene can be written to disk as a single block that is loaded
+// by mapping it into memory, so rendering doesn't need the scene code. The
+// file holds the objects and events as they are in memory, with each pointer
+// replaced by a file offset, or an index into the image and font tables.
+// A relocation table lists all of these, so loading is a single pass that
+// patches them in place. This ties compiled scenes to the architecture and
+// version of PAnim they were written with.
+#define PNM_SCENE_MAGIC "PNMSCENE"
+#define PNM_SCENE_VERSION 4
+
+typedef enum PAnimRelocKind {
+    PNM_RELOC_FILE,   // offset from the start of the file
+    PNM_RELOC_CAMERA, // offset into PAnimScene.camera
+    PNM_RELOC_IMAGE,  // index into the image table
+    PNM_RELOC_FONT,   // index into the font table
+} PAnimRelocKind;
+
+typedef struct {
+    uint64_t offset; // of a pointer sized field in the file
+    uint64_t kind;
+} PAnimRelocation;
+
+typedef struct {
+    uint64_t filename; // file offset of the string
+    int64_t size;      // point size for fonts, unused for images
+} PAnimAssetRef;
+
+/*
+ * Every stretchy buffer is stored with its BufHdr in front, so buf_len works
+ * on the mapped data; offsets point to the first element, zero means empty.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t pointer_size;
+    uint32_t object_size;
+    uint32_t event_size;
+    uint64_t file_size;
+    
+    uint64_t length_in_frames;
+    int32_t screen_width;
+    int32_t screen_height;
+    PAnimCamera camera;
+    SDL_Color bg_color;
+    
+    uint64_t objects;
+    uint64_t groups;
+    uint64_t timeline;
+    uint64_t spawn_order;
+    uint64_t despawn_order;
+    uint64_t key_frames;
+    
+    uint64_t images;
+    uint64_t image_count;
+    uint64_t fonts;
+    uint64_t font_count;
+    uint64_t relocations;
+    uint64_t relocation_count;
+} PAnimSceneHeader;
+
+typedef struct {
+    char * out;
+    PAnimRelocation * relocations;
+    
+    // Objects and groups are written as one block at `records_at`,
+    // `records` is a copy of it for looking up pointers
+    PAnimPtrMapping * map;
+    PAnimObject * records;
+    uint64_t records_at;
+    PAnimCamera * camera;
+} PAnimSceneWriter;
+
+// Appends `size` zeroed bytes at the next 8 byte boundary, returns their offset
+static uint64_t
+panim_scene_write_reserve(PAnimSceneWriter * w, size_t size)
+{
+    size_t at = (buf_len(w->out) + 7) & ~(size_t)7;
+    buf_fit(w->out, at + size);
+    memset(w->out + buf_len(w->out), 0, at + size - buf_len(w->out));
+    buf__hdr(w->out)->len = at + size;
+    return at;
+}
+
+static uint64_t
+panim_scene_write_buf(PAnimSceneWriter * w, const void * data, size_t count, size_t elem_size)
+{
+    if (count == 0) return 0;
+    
+    uint64_t at = panim_scene_write_reserve(w, offsetof(BufHdr, buf) + count * elem_size);
+    BufHdr *hdr = (BufHdr *)(w->out + at);
+    hdr->len = count;
+    hdr->cap = count;
+    memcpy(hdr->buf, data, count * elem_size);
+    return at + offsetof(BufHdr, buf);
+}
+
+static uint64_t
+panim_scene_write_string(PAnimSceneWriter * w, const char * str)
+{
+    size_t size = strlen(str) + 1;
+    uint64_t at = panim_scene_write_reserve(w, size);
+    memcpy(w->out + at, str, size);
+    return at;
+}
+
+static void
+panim_scene_write_relocation(PAnimSceneWriter * w, uint64_t at,
+                             uint64_t value, PAnimRelocKind kind)
+{
+    uintptr_t field = (uintptr_t) value;
+    memcpy(w->out + at, &field, sizeof(field));
+    buf_push(w->relocations, (PAnimRelocation){ at, kind });
+}
+
+// Writes a pointer to an object, a group, or into the camera, NULL stays zero
+static void
+panim_scene_write_pointer(PAnimSceneWriter * w, uint64_t at, void * ptr)
+{
+    if (!ptr) return;
+    
+    char *p = (char *) panim_ptr_remap(w->map, ptr);
+    char *camera = (char *) w->camera;
+    if (p >= camera && p < camera + sizeof(PAnimCamera)) {
+        panim_scene_write_relocation(w, at, (uint64_t)(p - camera), PNM_RELOC_CAMERA);
+    } else {
+        panim_scene_write_relocation(w, at, w->records_at + (uint64_t)(p - (char *) w->records),
+                                     PNM_RELOC_FILE);
     }
 }
 
-/* 
-* Plays back the scene in a preview window while also rendering it to a file.
-*/
+static size_t
+panim_engine_font_index(PAnimEngine * pnm, TTF_Font * font)
+{
+    for (size_t i = 0; i < buf_len(pnm->fonts); ++i) {
+        if (pnm->fonts[i].font == font) return i;
+    }
+    
+    ERROR("font was not loaded with panim_engine_load_font!");
+    return 0;
+}
+
+/*
+ * Writes a finalized, not yet updated scene to `filename`. Every event has
+ * to target the scene's objects or camera, and all images and fonts have to
+ * be loaded through the engine.
+ */
 static void
-panim_scene_render(PAnimEngine * pnm, PAnimScene * scene, char * filename)
+panim_scene_compile(PAnimEngine * pnm, PAnimScene * scene, const char * filename)
 {
-    // 
-    // Video Encoding Setup
-    // 
+    assert(scene->frame == PNM_FRAME_NEVER);
     
-    av_register_all();
-    avcodec_register_all();
+    size_t object_count = buf_len(scene->objects);
+    size_t group_count = buf_len(scene->groups);
+    size_t record_count = object_count + group_count;
     
-    AVFormatContext *fmt_ctx = NULL;
-    avformat_alloc_output_context2(&fmt_ctx, NULL, "mp4", filename);
-    if (!fmt_ctx) ERROR("failed to allocate an AVFormatContext");
+    PAnimSceneWriter w = {0};
+    w.camera = &scene->camera;
+    panim_scene_write_reserve(&w, sizeof(PAnimSceneHeader));
     
-    AVOutputFormat *fmt = fmt_ctx->oformat;
-    fmt->video_codec = AV_CODEC_ID_H264;
-    fmt->audio_codec = AV_CODEC_ID_NONE;
+    w.records = (PAnimObject *) malloc(MAX(record_count, 1) * sizeof(PAnimObject));
+    if (!w.records) ERROR("out of memory!");
+    w.records_at = panim_scene_write_reserve(&w, record_count * sizeof(PAnimObject));
     
-    AVCodec *codec = avcodec_find_encoder(fmt->video_codec);
-    if (!codec) ERROR("codec not found!");
+    buf_push(w.map, (PAnimPtrMapping){
+        (uintptr_t)&scene->camera, sizeof(PAnimCamera), (char *)&scene->camera });
+    for (size_t i = 0; i < record_count; ++i) {
+        PAnimObject *obj = i < object_count ? scene->objects[i] : scene->groups[i - object_count];
+        w.records[i] = *obj;
+        buf_push(w.map, (PAnimPtrMapping){
+            (uintptr_t)obj, sizeof(PAnimObject), (char *)(w.records + i) });
+    }
+    buf_sort(w.map, panim_ptr_mapping_sort);
     
-    AVStream *stream = avformat_new_stream(fmt_ctx, codec);
-    if (!stream) ERROR("failed to add video stream to container!");
-    stream->id = fmt_ctx->nb_streams - 1;
+    // Pointer arrays into the block, filled in by relocation
+    uint64_t objects_at = panim_scene_write_buf(&w, scene->objects, object_count, sizeof(void *));
+    uint64_t groups_at = panim_scene_write_buf(&w, scene->groups, group_count, sizeof(void *));
+    for (size_t i = 0; i < record_count; ++i) {
+        uint64_t at = i < object_count ? objects_at + i * sizeof(void *)
+                                       : groups_at + (i - object_count) * sizeof(void *);
+        panim_scene_write_relocation(&w, at, w.records_at + i * sizeof(PAnimObject), PNM_RELOC_FILE);
+    }
     
-    AVCodecContext *cdc_ctx = stream->codec;
-    { // Set codec parameters:
-        // TODO: specifying codec parameters like this is deprecated,
-        // you're supposed to use stream->codecpar, apparently, but I don't see
-        // how you'd specify most of these on that
-        
-        // TODO: codec-specific options (lossless?, CABAC?)
-        // I think you need to pass an AVOptions thing as the 3rd arg to
-        // avcodec_open2, but I can't seem to find out how to actually make one?
-        
-        cdc_ctx->width  = scene->screen_width;
-        cdc_ctx->height = scene->screen_height;
-        
-        // I don't know why you're supposed to do this, since avformat_write_header
-        // overwrites it with some ridiculous value later on, which is why we need
-        // to rescale our packets' timestamps in the main loop.
-        stream->time_base = (AVRational){1, 60};
-        
-        cdc_ctx->time_base = (AVRational){1, 60};
-        cdc_ctx->framerate = (AVRational){60, 1};
+    for (size_t i = 0; i < record_count; ++i) {
+        PAnimObject record = w.records[i];
+        record.parent = NULL;
+        switch (record.type) {
+            case PNM_OBJ_IMAGE: {
+                record.img.texture = NULL;
+            } break;
+            case PNM_OBJ_TEXT: {
+                record.txt.font = NULL;
+                record.txt.data = NULL;
+                record.txt.w = 0;
+                record.txt.h = 0;
+                record.txt.texture = NULL;
+                record.txt.surface = NULL;
+                record.txt.hash = 0;
+            } break;
+            default: break;
+        }
         
-        // YouTube recommends GOP of half the frame rate,
-        // i.e. at most one intra frame every thirty frames
-        cdc_ctx->gop_size = 30;
-        cdc_ctx->max_b_frames = 2;
-        cdc_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
-        cdc_ctx->bit_rate = 12000000; // Recommended bitrate for 1080p60 SDR
+        uint64_t at = w.records_at + i * sizeof(PAnimObject);
+        memcpy(w.out + at, &record, sizeof(PAnimObject));
+        panim_scene_write_pointer(&w, at + offsetof(PAnimObject, parent), w.records[i].parent);
         
-        if (fmt->flags & AVFMT_GLOBALHEADER)
-            cdc_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+        if (record.type == PNM_OBJ_IMAGE) {
+            PAnimImage *image = panim_engine_image(pnm, w.records[i].img.texture);
+            panim_scene_write_relocation(&w, at + offsetof(PAnimObject, img.texture),
+                                         (uint64_t)(image - pnm->images), PNM_RELOC_IMAGE);
+        } else if (record.type == PNM_OBJ_TEXT) {
+            panim_scene_write_relocation(&w, at + offsetof(PAnimObject, txt.font),
+                                         panim_engine_font_index(pnm, w.records[i].txt.font),
+                                         PNM_RELOC_FONT);
+            uint64_t data = panim_scene_write_string(&w, w.records[i].txt.data);
+            panim_scene_write_relocation(&w, at + offsetof(PAnimObject, txt.data),
+                                         data, PNM_RELOC_FILE);
+        }
     }
     
-    if (avcodec_open2(cdc_ctx, codec, NULL) < 0) ERROR("failed to open codec!");
-    
-    AVFrame *src_frame = panim_alloc_avframe(
-        AV_PIX_FMT_RGB32, cdc_ctx->width, cdc_ctx->height);
-    AVFrame *dst_frame = panim_alloc_avframe(
-        cdc_ctx->pix_fmt, cdc_ctx->width, cdc_ctx->height);
-    
-    struct SwsContext *sws_ctx = sws_getContext(
-        src_frame->width, src_frame->height, src_frame->format,
-        dst_frame->width, dst_frame->height, dst_frame->format,
-        0, 0, 0, 0);
-    if (!sws_ctx) ERROR("failed to get an SwsContext!");
+    uint64_t timeline_at = panim_scene_write_buf(
+        &w, scene->timeline, buf_len(scene->timeline), sizeof(PAnimEvent));
+    for (size_t i = 0; i < buf_len(scene->timeline); ++i) {
+        PAnimEvent *anim = scene->timeline + i;
+        uint64_t at = timeline_at + i * sizeof(PAnimEvent);
+        switch (anim->type) {
+            case PNM_EVENT_COLOR_FADE: {
+                panim_scene_write_pointer(&w, at + offsetof(PAnimEvent, colfd.object), anim->colfd.object);
+            } break;
+            case PNM_EVENT_MOVEMENT: {
+                panim_scene_write_pointer(&w, at + offsetof(PAnimEvent, move.x_val), anim->move.x_val);
+                panim_scene_write_pointer(&w, at + offsetof(PAnimEvent, move.y_val), anim->move.y_val);
+            } break;
+            case PNM_EVENT_COLOCATE: {
+                panim_scene_write_pointer(&w, at + offsetof(PAnimEvent, copy_pos.src), anim->copy_pos.src);
+                panim_scene_write_pointer(&w, at + offsetof(PAnimEvent, copy_pos.dst), anim->copy_pos.dst);
+            } break;
+            case PNM_EVENT_TWEEN: {
+                panim_scene_write_pointer(&w, at + offsetof(PAnimEvent, tween.value), anim->tween.value);
+            } break;
+            default: __debugbreak();
+        }
+    }
     
-    AVPacket *packet = av_packet_alloc();
-    if (!packet) ERROR("failed to allocate an AVPacket!");
+    PAnimSceneHeader header = {0};
+    memcpy(header.magic, PNM_SCENE_MAGIC, sizeof(header.magic));
+    header.version = PNM_SCENE_VERSION;
+    header.pointer_size = sizeof(void *);
+    header.object_size = sizeof(PAnimObject);
+    header.event_size = sizeof(PAnimEvent);
+    header.length_in_frames = scene->length_in_frames;
+    header.screen_width = scene->screen_width;
+    header.screen_height = scene->screen_height;
+    header.camera = scene->camera;
+    header.bg_color = scene->bg_color;
+    header.objects = objects_at;
+    header.groups = groups_at;
+    header.timeline = timeline_at;
+    header.spawn_order = panim_scene_write_buf(
+        &w, scene->spawn_order, buf_len(scene->spawn_order), sizeof(PAnimLifetimeMark));
+    header.despawn_order = panim_scene_write_buf(
+        &w, scene->despawn_order, buf_len(scene->despawn_order), sizeof(PAnimLifetimeMark));
+    header.key_frames = panim_scene_write_buf(
+        &w, scene->key_frames, buf_len(scene->key_frames), sizeof(uint32_t));
     
-    // Open the output file if needed
-    if (!(fmt->flags & AVFMT_NOFILE)) {
-        if (avio_open(&fmt_ctx->pb, filename, AVIO_FLAG_WRITE) < 0) {
-            ERROR("failed to open output file!");
-        }
+    header.image_count = buf_len(pnm->images);
+    header.images = panim_scene_write_reserve(&w, header.image_count * sizeof(PAnimAssetRef));
+    for (size_t i = 0; i < header.image_count; ++i) {
+        PAnimAssetRef ref = { panim_scene_write_string(&w, pnm->images[i].filename), 0 };
+        memcpy(w.out + header.images + i * sizeof(PAnimAssetRef), &ref, sizeof(ref));
     }
     
-    if (avformat_write_header(fmt_ctx, NULL) < 0) {
-        ERROR("failed to write file header!");
+    header.font_count = buf_len(pnm->fonts);
+    header.fonts = panim_scene_write_reserve(&w, header.font_count * sizeof(PAnimAssetRef));
+    for (size_t i = 0; i < header.font_count; ++i) {
+        PAnimAssetRef ref = { panim_scene_write_string(&w, pnm->fonts[i].filename), pnm->fonts[i].size };
+        memcpy(w.out + header.fonts + i * sizeof(PAnimAssetRef), &ref, sizeof(ref));
     }
     
-    // 
-    // Main Loop
-    // 
+    header.relocation_count = buf_len(w.relocations);
+    header.relocations = panim_scene_write_reserve(&w, buf_sizeof(w.relocations));
+    if (w.relocations) memcpy(w.out + header.relocations, w.relocations, buf_sizeof(w.relocations));
     
-    char title_buffer[1024];
+    header.file_size = buf_len(w.out);
+    memcpy(w.out, &header, sizeof(header));
     
-    for (size_t t = 0; t < scene->length_in_frames; ++t) {
-        snprintf(title_buffer, 1024, "PAnim - Rendering (%zd / %zd)",
-                 t, scene->length_in_frames);
-        SDL_SetWindowTitle(pnm->window, title_buffer);
-        
-        
-        panim_scene_frame_update(scene, t);
-        panim_scene_frame_render(pnm, scene);
-        
-        // Get backbuffer contents
-        fflush(stdout);
-        if (av_frame_make_writable(src_frame) < 0)
-            ERROR("failed to lock frame buffer!");
-        SDL_RenderReadPixels(pnm->renderer, NULL, 0,
-                             src_frame->data[0],
-                             src_frame->linesize[0]);
-        
-        // Convert between pixel formats (color spaces)
-        sws_scale(sws_ctx,
-                  src_frame->data, src_frame->linesize, 0, src_frame->height,
-                  dst_frame->data, dst_frame->linesize);
-        dst_frame->pts = t;
-        
-        panim_frame_encode(cdc_ctx, fmt_ctx, stream, dst_frame, packet);
-        SDL_RenderPresent(pnm->renderer);
-    }
+    FILE *file = fopen(filename, "wb");
+    if (!file) ERROR("failed to open compiled scene for writing!");
+    if (fwrite(w.out, 1, buf_len(w.out), file) != buf_len(w.out)) ERROR("failed to write compiled scene!");
+    fclose(file);
     
-    panim_frame_encode(cdc_ctx, fmt_ctx, stream, NULL, packet); // Flush the encoder
-    av_write_trailer(fmt_ctx);
+    printf("Compiled %zu objects, %zu groups and %zu events into %zu bytes\n",
+           object_count, group_count, buf_len(scene->timeline), buf_len(w.out));
     
-    // Close the output stream
-    avcodec_close(stream->codec);
-    av_frame_free(&src_frame);
-    av_frame_free(&dst_frame);
-    sws_freeContext(sws_ctx);
+    free(w.records);
+    buf_free(w.map);
+    buf_free(w.relocations);
+    buf_free(w.out);
+}
+
+// Maps a file copy-on-write, so relocations don't change it on disk
+static char *
+panim_map_file(const char * filename, size_t * size)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) ERROR("failed to open compiled scene!");
     
-    if (!(fmt->flags & AVFMT_NOFILE)) avio_closep(&fmt_ctx->pb);
-    avformat_free_context(fmt_ctx);
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) ERROR("not a compiled scene!");
+    *size = (size_t) file_size.QuadPart;
     
-    //---
-    panim_engine_end_preview(pnm);
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    if (!mapping) ERROR("failed to map compiled scene!");
+    char *data = (char *) MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    if (!data) ERROR("failed to map compiled scene!");
+    
+    // The view keeps the file open
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return data;
+#else
+    int file = open(filename, O_RDONLY);
+    if (file < 0) ERROR("failed to open compiled scene!");
+    
+    struct stat info;
+    if (fstat(file, &info) != 0 || info.st_size == 0) ERROR("not a compiled scene!");
+    *size = (size_t) info.st_size;
+    
+    void *data = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+    if (data == MAP_FAILED) ERROR("failed to map compiled scene!");
+    
+    close(file);
+    return (char *) data;
+#endif
 }
 
-static inline void
-panim_scene_frame_update(PAnimScene * scene, size_t t)
+static void
+panim_unmap_file(char * data, size_t size)
 {
-    for (PAnimEvent * anim = scene->timeline;
-         anim < scene->timeline + buf_len(scene->timeline);
-         ++anim)
-    {
-        panim_event_tick(anim, t);
-    }
+#ifdef _WIN32
+    (void) size;
+    UnmapViewOfFile(data);
+#else
+    munmap(data, size);
+#endif
 }
 
-static inline void
-panim_scene_frame_render(PAnimEngine * pnm, PAnimScene * scene)
+static inline PAnimSceneHeader *
+panim_scene_header(PAnimScene * scene)
+{
+    return (PAnimSceneHeader *) scene->file;
+}
+
+/*
+ * Maps a scene written by panim_scene_compile, and resolves all pointers
+ * within it. The result is finalized already, but its images and fonts still
+ * have to be loaded with panim_scene_load_assets, once there is an engine.
+ * The scene must not be moved afterwards, as events may point into it.
+ */
+static void
+panim_scene_load(PAnimScene * scene, const char * filename)
 {
-    SDL_Color bg = scene->bg_color;
-    SDL_SetRenderDrawColor(
-        pnm->renderer, bg.r, bg.g, bg.b, bg.a);
-    SDL_RenderClear(pnm->renderer);
+    size_t size;
+    char *file = panim_map_file(filename, &size);
+    PAnimSceneHeader *header = (PAnimSceneHeader *) file;
+    
+    if (size < sizeof(PAnimSceneHeader) ||
+        memcmp(header->magic, PNM_SCENE_MAGIC, sizeof(header->magic)) != 0) {
+        ERROR("not a compiled scene!");
+    }
+    if (header->version != PNM_SCENE_VERSION ||
+        header->pointer_size != sizeof(void *) ||
+        header->object_size != sizeof(PAnimObject) ||
+        header->event_size != sizeof(PAnimEvent)) {
+        ERROR("scene was compiled by a different build of PAnim!");
+    }
+    if (header->file_size != size) ERROR("compiled scene is truncated!");
     
-    for (int i = 0; i < buf_len(scene->objects); ++i) {
-        panim_object_draw(pnm, scene->objects[i]);
+    memset(scene, 0, sizeof(PAnimScene));
+    scene->length_in_frames = header->length_in_frames;
+    scene->screen_width = header->screen_width;
+    scene->screen_height = header->screen_height;
+    scene->camera = header->camera;
+    scene->bg_color = header->bg_color;
+    scene->objects = header->objects ? (PAnimObject **)(file + header->objects) : NULL;
+    scene->groups = header->groups ? (PAnimObject **)(file + header->groups) : NULL;
+    scene->timeline = header->timeline ? (PAnimEvent *)(file + header->timeline) : NULL;
+    scene->spawn_order = header->spawn_order ? (PAnimLifetimeMark *)(file + header->spawn_order) : NULL;
+    scene->despawn_order = header->despawn_order ? (PAnimLifetimeMark *)(file + header->despawn_order) : NULL;
+    scene->key_frames = header->key_frames ? (uint32_t *)(file + header->key_frames) : NULL;
+    scene->frame = PNM_FRAME_NEVER;
+    scene->file = file;
+    scene->file_size = size;
+    
+    PAnimRelocation *relocations = (PAnimRelocation *)(file + header->relocations);
+    for (size_t i = 0; i < header->relocation_count; ++i) {
+        uintptr_t *field = (uintptr_t *)(file + relocations[i].offset);
+        switch (relocations[i].kind) {
+            case PNM_RELOC_FILE:   *field += (uintptr_t) file; break;
+            case PNM_RELOC_CAMERA: *field += (uintptr_t) &scene->camera; break;
+            default: break;
+        }
     }
 }
 
-/* 
-* Plays back the scene in a preview window without rendering to a file.
-*/
+/*
+ * Loads the images and fonts a compiled scene refers to, and points its
+ * objects at them.
+ */
 static void
-panim_scene_play(PAnimEngine * pnm, PAnimScene * scene)
+panim_scene_load_assets(PAnimEngine * pnm, PAnimScene * scene)
 {
-    char title_buffer[1024];
+    PAnimSceneHeader *header = panim_scene_header(scene);
+    PAnimAssetRef *image_refs = (PAnimAssetRef *)(scene->file + header->images);
+    PAnimAssetRef *font_refs = (PAnimAssetRef *)(scene->file + header->fonts);
     
-    bool paused = false;
-    size_t playback_speed = 1;
+    SDL_Texture **images = NULL;
+    for (size_t i = 0; i < header->image_count; ++i) {
+        buf_push(images, panim_engine_load_image(pnm, scene->file + image_refs[i].filename));
+    }
     
-    for (size_t t = 0; t < scene->length_in_frames;) {
-        Uint32 ticks_at_start_of_frame = SDL_GetTicks();
-        
-        SDL_Event event;
-        if (SDL_PollEvent(&event)) {
-            if (event.type == SDL_QUIT) goto end;
-            if (event.type == SDL_KEYUP) switch (event.key.keysym.sym) {
-                case SDLK_ESCAPE: {
-                    goto end;
-                } break;
-                case SDLK_SPACE: case 'k': {
-                    paused = !paused;
-                } break;
-                case 'l': {
-                    if (playback_speed < 4)
-                        playback_speed += 1;
-                } break;
-                case 'j': {
-                    if (playback_speed > 1)
-                        playback_speed -= 1;
-                } break;
-            }
-        }
-        
-        snprintf(title_buffer, 1024, "PAnim - Preview (%zd / %zd)",
-                 t, scene->length_in_frames);
-        SDL_SetWindowTitle(pnm->window, title_buffer);
-        
-        if (!paused) for (size_t i = 0; i < playback_speed; ++i) {
-            panim_scene_frame_update(scene, t++);
+    TTF_Font **fonts = NULL;
+    for (size_t i = 0; i < header->font_count; ++i) {
+        buf_push(fonts, panim_engine_load_font(
+            pnm, scene->file + font_refs[i].filename, (int) font_refs[i].size));
+    }
+    
+    PAnimRelocation *relocations = (PAnimRelocation *)(scene->file + header->relocations);
+    for (size_t i = 0; i < header->relocation_count; ++i) {
+        uintptr_t *field = (uintptr_t *)(scene->file + relocations[i].offset);
+        switch (relocations[i].kind) {
+            case PNM_RELOC_IMAGE: *field = (uintptr_t) images[*field]; break;
+            case PNM_RELOC_FONT:  *field = (uintptr_t) fonts[*field]; break;
+            default: break;
         }
-        
-        panim_scene_frame_render(pnm, scene);
-        
-        SDL_RenderPresent(pnm->renderer);
-        Uint32 frame_time = SDL_GetTicks() - ticks_at_start_of_frame;
-        if (frame_time < 16) {
-            SDL_Delay(16 - frame_time);
+    }
+    
+    buf_free(images);
+    buf_free(fonts);
+}
+
+/*
+ * Frees everything a scene owns, built or loaded, leaving it empty. Images
+ * and fonts belong to the engine and stay loaded until
+ * panim_engine_end_preview.
+ */
+static void
+panim_scene_destroy(PAnimScene * scene)
+{
+    for (size_t i = 0; i < buf_len(scene->objects); ++i) {
+        PAnimObject *obj = scene->objects[i];
+        if (obj->type != PNM_OBJ_TEXT) continue;
+        if (obj->txt.texture) SDL_DestroyTexture(obj->txt.texture);
+        if (obj->txt.surface) SDL_FreeSurface(obj->txt.surface);
+    }
+    
+    buf_free(scene->live);
+    buf_free(scene->active);
+    buf_free(scene->text_cache);
+    if (scene->file) {
+        panim_unmap_file(scene->file, scene->file_size);
+    } else {
+        for (size_t i = 0; i < buf_len(scene->arena); ++i) free(scene->arena[i]);
+        buf_free(scene->arena);
+        buf_free(scene->objects);
+        buf_free(scene->groups);
+        buf_free(scene->timeline);
+        buf_free(scene->spawn_order);
+        buf_free(scene->despawn_order);
+        buf_free(scene->key_frames);
+    }
+    
+    memset(scene, 0, sizeof(PAnimScene));
+}
+
+typedef struct {
+    char * filename;
+    char * cache_dir;
+    char * manifest_name;
+    char * compile_name;
+    char ** inputs;
+    int jobs;
+    int segments;
+    bool stitch;
+    bool ranged; // --from or --to were given
+    size_t from;
+    size_t to;
+    bool valid;
+} PAnimOptions;
+
+static PAnimOptions
+panim_options_parse(int arg_count, char * arg_values[])
+{
+    PAnimOptions options = {0};
+    options.to = SIZE_MAX;
+    options.valid = true;
+    
+    for (int i = 1; i < arg_count; ++i) {
+        char *arg = arg_values[i];
+        bool has_value = i + 1 < arg_count;
+        if (strcmp(arg, "--jobs") == 0 && has_value) {
+            options.jobs = atoi(arg_values[++i]);
+        } else if (strcmp(arg, "--from") == 0 && has_value) {
+            options.from = (size_t) strtoull(arg_values[++i], NULL, 10);
+            options.ranged = true;
+        } else if (strcmp(arg, "--to") == 0 && has_value) {
+            options.to = (size_t) strtoull(arg_values[++i], NULL, 10);
+            options.ranged = true;
+        } else if (strcmp(arg, "--segments") == 0 && has_value) {
+            options.segments = atoi(arg_values[++i]);
+        } else if (strcmp(arg, "--cache") == 0 && has_value) {
+            options.cache_dir = arg_values[++i];
+        } else if (strcmp(arg, "--manifest") == 0 && has_value) {
+            options.manifest_name = arg_values[++i];
+        } else if (strcmp(arg, "--compile") == 0 && has_value) {
+            options.compile_name = arg_values[++i];
+        } else if (strcmp(arg, "--stitch") == 0) {
+            options.stitch = true;
+        } else if (arg[0] != '-' && !options.filename) {
+            options.filename = arg;
+        } else if (arg[0] != '-' && options.stitch) {
+            buf_push(options.inputs, arg);
+        } else {
+            options.valid = false;
         }
     }
     
-    end: panim_engine_end_preview(pnm);
+    return options;
+}
+
+// Without an output file, and no options other than --manifest
+static bool
+panim_options_preview(PAnimOptions * options)
+{
+    return options->valid && !options->filename && !options->compile_name &&
+        !options->jobs && !options->segments && !options->cache_dir &&
+        !options->stitch && !options->ranged;
 }
 
 static int
@@ -813,16 +6207,155 @@ panim_main(int arg_count, char * arg_values[],
            PAnimEngine * pnm, PAnimScene * scene)
 {
     panim_scene_finalize(scene);
-    if (arg_count == 1) {
-        panim_scene_play(pnm, scene);
+    
+    PAnimOptions options = panim_options_parse(arg_count, arg_values);
+    char * filename = options.filename;
+    char * manifest_name = options.manifest_name;
+    char * cache_dir = options.cache_dir;
+    int jobs = options.jobs;
+    int segments = options.segments;
+    size_t from = options.from;
+    size_t to = MIN(options.to, scene->length_in_frames);
+    
+    if (options.compile_name && options.valid && !filename && !manifest_name &&
+        !jobs && !segments && !cache_dir && !options.stitch && !options.ranged) {
+        panim_scene_compile(pnm, scene, options.compile_name);
+        panim_scene_destroy(scene);
+        panim_engine_end_preview(pnm);
+        return 0;
+    }
+    
+    PAnimManifest manifest;
+    PAnimManifest *checksums = manifest_name ? &manifest : NULL;
+    
+    if (panim_options_preview(&options)) {
+        if (checksums) panim_manifest_open(checksums, manifest_name, scene);
+        panim_scene_play(pnm, scene, checksums);
+        if (checksums) panim_manifest_close(checksums);
+        return 0;
+    }
+    
+    if (!filename || !options.valid || options.compile_name || (options.stitch && !options.inputs)) {
+        printf("Usage: %s [--manifest <File>]\n"
+               "       %s --compile <File>\n"
+               "       %s [--jobs <Threads>] [--from <Frame>] [--to <Frame>] [--manifest <File>] <OutFile>\n"
+               "       %s [--jobs <Threads>] --segments <Processes> <OutFile>\n"
+               "       %s [--jobs <Threads>] --cache <Directory> <OutFile>\n"
+               "       %s --stitch <OutFile> <InFiles...>\n",
+               arg_values[0], arg_values[0], arg_values[0], arg_values[0], arg_values[0],
+               arg_values[0]);
+        buf_free(options.inputs);
+        panim_scene_destroy(scene);
+        panim_engine_end_preview(pnm);
+        return 0;
+    }
+    
+    if (checksums && (options.stitch || segments > 0 || cache_dir)) {
+        ERROR("--manifest only works with previews and single renders!");
+    }
+    
+    if (options.stitch) {
+        panim_stitch(filename, options.inputs, buf_len(options.inputs));
+        buf_free(options.inputs);
+        panim_scene_destroy(scene);
+        panim_engine_end_preview(pnm);
         return 0;
-    } else if (arg_count != 2) {
-        printf("Usage: %s <OutFile>\n", arg_values[0]);
+    }
+    
+    if (segments > 0) {
+        int result = panim_render_segments(arg_values[0], scene, filename, segments, jobs);
+        panim_scene_destroy(scene);
+        panim_engine_end_preview(pnm);
+        return result;
+    }
+    
+    if (cache_dir) {
+        if (from != 0 || to != scene->length_in_frames) {
+            ERROR("--cache always renders the whole scene!");
+        }
+        panim_scene_render_cached(pnm, scene, filename, cache_dir, jobs);
+        panim_scene_destroy(scene);
+        panim_engine_end_preview(pnm);
         return 0;
     }
     
-    char * filename = arg_values[1];
-    panim_scene_render(pnm, scene, filename);
+    if (from % PNM_GOP_SIZE != 0) ERROR("--from has to be a multiple of the GOP size (30)!");
+    if (from > to) ERROR("empty frame range!");
+    
+    if (checksums) panim_manifest_open(checksums, manifest_name, scene);
+    if (jobs > 0) {
+        panim_scene_render_parallel(pnm, scene, filename, from, to, jobs, checksums);
+    } else {
+        panim_scene_render(pnm, scene, filename, from, to, checksums);
+    }
+    
+    if (checksums) panim_manifest_close(checksums);
+    panim_scene_destroy(scene);
+    panim_engine_end_preview(pnm);
+    return 0;
+}
+
+/*
+ * Builds the scene and hands it to panim_main. For a plain preview, the scene
+ * is built on a thread instead, and the preview starts with the first frames
+ * the scene code seals.
+ */
+static int
+panim_main_stream(int arg_count, char * arg_values[], PAnimEngine * pnm,
+                  PAnimScene * scene, PAnimSceneBuildFunc * build)
+{
+    PAnimOptions options = panim_options_parse(arg_count, arg_values);
+    buf_free(options.inputs);
+    if (!panim_options_preview(&options) || options.manifest_name) {
+        build(scene);
+        return panim_main(arg_count, arg_values, pnm, scene);
+    }
+    
+    PAnimSceneStream stream;
+    panim_scene_stream_start(&stream, scene, build);
+    
+    PAnimPlayback playback = panim_playback_default();
+    playback.stream = &stream;
+    panim_scene_preview(pnm, scene, NULL, &playback);
     
+    // The scene code only notices once it adds to the scene again, which
+    // may take a while, so the window doesn't wait for it
+    if (!stream.done) {
+        SDL_HideWindow(pnm->window);
+        printf("Abandoning the scene still being built...\n");
+    }
+    panim_scene_stream_stop(&stream);
+    panim_scene_destroy(scene);
+    panim_engine_end_preview(pnm);
     return 0;
-}
\ No newline at end of file
+}
+
+/*
+ * Scene files end in PANIM_SCENE(setup, load, build). `setup` sets the screen
+ * size and background color, before there is an engine, `load` loads images
+ * and fonts, and `build` populates the scene, on a thread of its own when
+ * previewing, see panim_scene_seal. Normally, this defines main. Built as a
+ * shared library with PANIM_MODULE defined, it exports the three functions
+ * instead, for panim_host.c to reload the scene whenever it is rebuilt.
+ */
+#ifdef _WIN32
+#define PNM_EXPORT __declspec(dllexport)
+#else
+#define PNM_EXPORT __attribute__((visibility("default")))
+#endif
+
+#ifdef PANIM_MODULE
+#define PANIM_SCENE(setup, load, build) \
+    PNM_EXPORT void panim_module_setup(PAnimScene * scene) { setup(scene); } \
+    PNM_EXPORT void panim_module_load(PAnimEngine * pnm) { load(pnm); } \
+    PNM_EXPORT void panim_module_build(PAnimScene * scene) { build(scene); }
+#else
+#define PANIM_SCENE(setup, load, build) \
+    int main(int argc, char *argv[]) { \
+        PAnimScene scene = {0}; \
+        setup(&scene); \
+        PAnimEngine pnm = panim_engine_begin_preview(&scene); \
+        load(&pnm); \
+        return panim_main_stream(argc, argv, &pnm, &scene, build); \
+    }
+#endif
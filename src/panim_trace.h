@@ -0,0 +1,314 @@
+/*******************************************************************************
+Author: Tristan Dannenberg
+Notice: No warranty is offered or implied; use this code at your own risk.
+*******************************************************************************/
+
+/*
+ * Records what an algorithm does to its arrays, as compact binary records,
+ * so that it can run on real inputs while being annotated. Each thread
+ * fills a ring of blocks of its own, without taking any locks, and a writer
+ * thread takes full blocks out of all rings and writes them to the trace
+ * file. Records are stamped with the CPU's time stamp counter, so the
+ * threads can be merged back into a single stream, in the order things
+ * happened. panim_trace_build in panim.h later turns any window of the
+ * trace into a scene.
+ *
+ *     panim_trace_begin("sort.pnmt");
+ *     panim_trace_alloc(0, count);
+ *     ...
+ *     panim_trace_compare(0, i, j);
+ *     panim_trace_swap(0, i, j);
+ *     ...
+ *     panim_trace_end();
+ *
+ * Arrays are identified by numbers from 0 to 255. Recording while no trace
+ * is open does nothing, and begin and end must not be called while other
+ * threads are still recording.
+ */
+
+#include "stdbool.h"
+#include "stdint.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+
+#include "SDL/SDL.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include "intrin.h"
+#define PNM_TRACE_RDTSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include "x86intrin.h"
+#define PNM_TRACE_RDTSC 1
+#endif
+
+#ifndef ERROR
+#define ERROR(E) do { fprintf(stderr, "Error: " E "\n"); exit(1); } while (0)
+#endif
+
+#ifdef _MSC_VER
+#define PNM_THREAD_LOCAL __declspec(thread)
+#else
+#define PNM_THREAD_LOCAL __thread
+#endif
+
+#define PNM_TRACE_MAGIC "PNMTRACE"
+#define PNM_TRACE_VERSION 2
+
+// Each thread's ring holds 16 blocks of 4096 records, 1.5 MB in total
+#define PNM_TRACE_BLOCK_RECORDS 4096
+#define PNM_TRACE_RING_BLOCKS 16
+
+typedef enum PAnimTraceOp {
+    PNM_TRACE_INVALID,
+    PNM_TRACE_ALLOC,   // value: number of elements, all zero
+    PNM_TRACE_READ,    // value: what was read
+    PNM_TRACE_WRITE,   // value: what was written
+    PNM_TRACE_COMPARE, // value: the other index
+    PNM_TRACE_SWAP,    // value: the other index
+    PNM_TRACE_MARK,    // index: any number, to find windows by
+} PAnimTraceOp;
+
+typedef struct {
+    uint8_t op;
+    uint8_t array;
+    uint16_t thread; // in the order threads first recorded something
+    uint32_t index;
+    int64_t value;
+    uint64_t time; // see panim_trace_clock
+} PAnimTraceRecord;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+} PAnimTraceHeader;
+
+typedef struct {
+    PAnimTraceRecord records[PNM_TRACE_BLOCK_RECORDS];
+} PAnimTraceBlock;
+
+/*
+ * A single-producer, single-consumer ring: the thread fills the block at
+ * `tail`, and the writer writes out the blocks from `head` up to it.
+ */
+typedef struct PAnimTraceBuffer {
+    PAnimTraceBlock * blocks;
+    PAnimTraceRecord * next; // in the block being filled
+    PAnimTraceRecord * end;
+    int filled; // the thread's own copy of `tail`
+    SDL_atomic_t head;
+    SDL_atomic_t tail;
+    uint16_t thread;
+    struct PAnimTraceBuffer * link; // all buffers of the trace
+} PAnimTraceBuffer;
+
+static struct {
+    FILE * file;
+    SDL_Thread * writer;
+    SDL_atomic_t quit;
+    void * buffers; // PAnimTraceBuffer list, only ever pushed to while recording
+    SDL_atomic_t thread_count;
+    uint32_t generation; // of the open trace, so threads notice stale buffers
+} panim_trace;
+
+static PNM_THREAD_LOCAL PAnimTraceBuffer * panim_trace_local;
+static PNM_THREAD_LOCAL uint32_t panim_trace_local_generation;
+
+/*
+ * Cheap enough to call for every record. The time stamp counter ticks at a
+ * constant rate on all cores of current x86 CPUs; elsewhere, this falls
+ * back to the performance counter.
+ */
+static inline uint64_t
+panim_trace_clock(void)
+{
+#ifdef PNM_TRACE_RDTSC
+    return __rdtsc();
+#else
+    return SDL_GetPerformanceCounter();
+#endif
+}
+
+static void
+panim_trace_write_records(PAnimTraceRecord * records, size_t count)
+{
+    if (count && fwrite(records, sizeof(PAnimTraceRecord), count, panim_trace.file) != count) {
+        ERROR("failed to write trace file!");
+    }
+}
+
+// Writes out all blocks that were filled, returns whether there were any
+static bool
+panim_trace_drain(void)
+{
+    bool wrote = false;
+    PAnimTraceBuffer *buffer = (PAnimTraceBuffer *) SDL_AtomicGetPtr(&panim_trace.buffers);
+    for (; buffer; buffer = buffer->link) {
+        int head = SDL_AtomicGet(&buffer->head);
+        int tail = SDL_AtomicGet(&buffer->tail);
+        SDL_MemoryBarrierAcquire();
+        for (; head != tail; ++head) {
+            PAnimTraceBlock *block = buffer->blocks + head % PNM_TRACE_RING_BLOCKS;
+            panim_trace_write_records(block->records, PNM_TRACE_BLOCK_RECORDS);
+            SDL_AtomicSet(&buffer->head, head + 1);
+            wrote = true;
+        }
+    }
+    return wrote;
+}
+
+static int
+panim_trace_writer(void * data)
+{
+    (void) data;
+    while (!SDL_AtomicGet(&panim_trace.quit)) {
+        if (!panim_trace_drain()) SDL_Delay(1);
+    }
+    return 0;
+}
+
+static void
+panim_trace_begin(const char * filename)
+{
+    if (panim_trace.file) ERROR("a trace is already being recorded!");
+    
+    panim_trace.file = fopen(filename, "wb");
+    if (!panim_trace.file) ERROR("failed to open trace file!");
+    panim_trace.generation += 1;
+    SDL_AtomicSet(&panim_trace.thread_count, 0);
+    SDL_AtomicSet(&panim_trace.quit, 0);
+    
+    PAnimTraceHeader header = {0};
+    memcpy(header.magic, PNM_TRACE_MAGIC, sizeof(header.magic));
+    header.version = PNM_TRACE_VERSION;
+    header.record_size = sizeof(PAnimTraceRecord);
+    if (fwrite(&header, sizeof(header), 1, panim_trace.file) != 1) {
+        ERROR("failed to write trace file!");
+    }
+    
+    panim_trace.writer = SDL_CreateThread(panim_trace_writer, "PAnim Trace", NULL);
+    if (!panim_trace.writer) ERROR("failed to create thread!");
+}
+
+// Gives the calling thread a ring for the open trace
+static PAnimTraceBuffer *
+panim_trace_attach(void)
+{
+    PAnimTraceBuffer *buffer = (PAnimTraceBuffer *) calloc(1, sizeof(PAnimTraceBuffer));
+    if (!buffer) ERROR("out of memory!");
+    buffer->blocks = (PAnimTraceBlock *) malloc(PNM_TRACE_RING_BLOCKS * sizeof(PAnimTraceBlock));
+    if (!buffer->blocks) ERROR("out of memory!");
+    buffer->next = buffer->blocks[0].records;
+    buffer->end = buffer->next + PNM_TRACE_BLOCK_RECORDS;
+    buffer->thread = (uint16_t) SDL_AtomicAdd(&panim_trace.thread_count, 1);
+    
+    void *link;
+    do {
+        link = SDL_AtomicGetPtr(&panim_trace.buffers);
+        buffer->link = (PAnimTraceBuffer *) link;
+    } while (!SDL_AtomicCASPtr(&panim_trace.buffers, link, buffer));
+    
+    panim_trace_local = buffer;
+    panim_trace_local_generation = panim_trace.generation;
+    return buffer;
+}
+
+// Hands the full block to the writer, waiting only if the ring is full
+static void
+panim_trace_publish(PAnimTraceBuffer * buffer)
+{
+    buffer->filled += 1;
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&buffer->tail, buffer->filled);
+    
+    while (buffer->filled - SDL_AtomicGet(&buffer->head) == PNM_TRACE_RING_BLOCKS) SDL_Delay(1);
+    buffer->next = buffer->blocks[buffer->filled % PNM_TRACE_RING_BLOCKS].records;
+    buffer->end = buffer->next + PNM_TRACE_BLOCK_RECORDS;
+}
+
+static inline void
+panim_trace_record(PAnimTraceOp op, int array, size_t index, int64_t value)
+{
+    PAnimTraceBuffer *buffer = panim_trace_local;
+    if (!buffer || panim_trace_local_generation != panim_trace.generation) {
+        if (!panim_trace.file) return;
+        buffer = panim_trace_attach();
+    }
+    
+    PAnimTraceRecord *record = buffer->next++;
+    record->op = (uint8_t) op;
+    record->array = (uint8_t) array;
+    record->thread = buffer->thread;
+    record->index = (uint32_t) index;
+    record->value = value;
+    record->time = panim_trace_clock();
+    
+    if (buffer->next == buffer->end) panim_trace_publish(buffer);
+}
+
+/*
+ * Writes out what all threads recorded, and closes the trace file. Rings
+ * of threads that already exited are written out as well.
+ */
+static void
+panim_trace_end(void)
+{
+    if (!panim_trace.file) return;
+    
+    SDL_AtomicSet(&panim_trace.quit, 1);
+    SDL_WaitThread(panim_trace.writer, NULL);
+    panim_trace_drain();
+    
+    PAnimTraceBuffer *buffer = (PAnimTraceBuffer *) SDL_AtomicGetPtr(&panim_trace.buffers);
+    while (buffer) {
+        PAnimTraceRecord *first = buffer->blocks[buffer->filled % PNM_TRACE_RING_BLOCKS].records;
+        panim_trace_write_records(first, (size_t)(buffer->next - first));
+        
+        PAnimTraceBuffer *link = buffer->link;
+        free(buffer->blocks);
+        free(buffer);
+        buffer = link;
+    }
+    SDL_AtomicSetPtr(&panim_trace.buffers, NULL);
+    
+    if (fclose(panim_trace.file) != 0) ERROR("failed to write trace file!");
+    panim_trace.file = NULL;
+    panim_trace.generation += 1;
+}
+
+static inline void
+panim_trace_alloc(int array, size_t count)
+{
+    panim_trace_record(PNM_TRACE_ALLOC, array, 0, (int64_t) count);
+}
+
+static inline void
+panim_trace_read(int array, size_t index, int64_t value)
+{
+    panim_trace_record(PNM_TRACE_READ, array, index, value);
+}
+
+static inline void
+panim_trace_write(int array, size_t index, int64_t value)
+{
+    panim_trace_record(PNM_TRACE_WRITE, array, index, value);
+}
+
+static inline void
+panim_trace_compare(int array, size_t i, size_t j)
+{
+    panim_trace_record(PNM_TRACE_COMPARE, array, i, (int64_t) j);
+}
+
+static inline void
+panim_trace_swap(int array, size_t i, size_t j)
+{
+    panim_trace_record(PNM_TRACE_SWAP, array, i, (int64_t) j);
+}
+
+static inline void
+panim_trace_mark(size_t id)
+{
+    panim_trace_record(PNM_TRACE_MARK, 0, id, 0);
+}
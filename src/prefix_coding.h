@@ -15,6 +15,7 @@ typedef enum CodeTreeType {
 typedef struct CodeTree {
     CodeTreeType type;
     int freq;
+    PAnimObject * group; // all objects making up this (sub-)tree
     union {
         struct {
             char symbol;
@@ -46,22 +47,24 @@ make_leaf_node(PAnimScene * scene,
     result.type = CTT_LEAF;
     result.freq = freq;
     result.sym.symbol  = symbol;
+    result.group = panim_scene_add_group(scene, NULL, center_x, center_y);
     
     result.sym.bgi = panim_fade_in_image(
-        scene, circle, 1, center_x, center_y,
+        scene, circle, 1, 0, 0,
         begin_frame, 30);
+    panim_object_set_parent(result.sym.bgi, result.group, false);
     
-    char *lbl = (char *) malloc(2);
-    lbl[0] = symbol; lbl[1] = 0;
+    char lbl[4] = { symbol, 0 };
     result.sym.txt = panim_fade_in_text(
         scene, lbl, font, (SDL_Color){ 0xFF, 0xFF, 0xFF, 0xFF }, 2,
-        center_x, center_y, PNM_TXT_ALIGN_CENTER, begin_frame, 30);
+        0, 0, PNM_TXT_ALIGN_CENTER, begin_frame, 30);
+    panim_object_set_parent(result.sym.txt, result.group, false);
     
-    lbl = (char *) malloc(2);
     snprintf(lbl, 2, "%d", freq);
     result.sym.cnt = panim_fade_in_text(
         scene, lbl, font, (SDL_Color){ 0xFF, 0xFF, 0xFF, 0xFF }, 2,
-        center_x, center_y + 70, PNM_TXT_ALIGN_CENTER, begin_frame, 30);
+        0, 70, PNM_TXT_ALIGN_CENTER, begin_frame, 30);
+    panim_object_set_parent(result.sym.cnt, result.group, false);
     
     return result;
 }
@@ -71,59 +74,8 @@ move_tree(PAnimScene * scene, CodeTree * tree,
           int offset_x, int offset_y,
           size_t begin_frame, size_t length)
 {
-    if (tree->type == CTT_LEAF) {
-        panim_scene_add_move(
-            scene, &tree->sym.bgi->img.location.x, &tree->sym.bgi->img.location.y,
-            offset_x, offset_y, true, begin_frame, length);
-        panim_scene_add_move(
-            scene, &tree->sym.txt->txt.center_x, &tree->sym.txt->txt.center_y,
-            offset_x, offset_y, true, begin_frame, length);
-        panim_scene_add_move(
-            scene, &tree->sym.cnt->txt.center_x, &tree->sym.cnt->txt.center_y,
-            offset_x, offset_y, true, begin_frame, length);
-    } else if (tree->type == CTT_INTERNAL) {
-        panim_scene_add_move(
-            scene, &tree->children.node_bg->img.location.x,
-            &tree->children.node_bg->img.location.y,
-            offset_x, offset_y, true, begin_frame, length);
-        panim_scene_add_move(
-            scene, &tree->children.node_txt->txt.center_x,
-            &tree->children.node_txt->txt.center_y,
-            offset_x, offset_y, true, begin_frame, length);
-        if (tree->children.lbl_l) {
-            panim_scene_add_move(
-                scene, &tree->children.lbl_l->txt.center_x,
-                &tree->children.lbl_l->txt.center_y,
-                offset_x, offset_y, true, begin_frame, length);
-        }
-        panim_scene_add_move(
-            scene, &tree->children.linel->line.x1,
-            &tree->children.linel->line.y1,
-            offset_x, offset_y, true, begin_frame, length);
-        panim_scene_add_move(
-            scene, &tree->children.linel->line.x2,
-            &tree->children.linel->line.y2,
-            offset_x, offset_y, true, begin_frame, length);
-        if (tree->children.lbl_r) {
-            panim_scene_add_move(
-                scene, &tree->children.lbl_r->txt.center_x,
-                &tree->children.lbl_r->txt.center_y,
-                offset_x, offset_y, true, begin_frame, length);
-        }
-        panim_scene_add_move(
-            scene, &tree->children.liner->line.x1,
-            &tree->children.liner->line.y1,
-            offset_x, offset_y, true, begin_frame, length);
-        panim_scene_add_move(
-            scene, &tree->children.liner->line.x2,
-            &tree->children.liner->line.y2,
-            offset_x, offset_y, true, begin_frame, length);
-        
-        move_tree(
-            scene, tree->children.left, offset_x, offset_y, begin_frame, length);
-        move_tree(
-            scene, tree->children.right, offset_x, offset_y, begin_frame, length);
-    }
+    panim_move_group(
+        scene, tree->group, offset_x, offset_y, true, begin_frame, length);
 }
 
 static CodeTree
@@ -142,34 +94,42 @@ combine_nodes(PAnimScene * scene,
     move_tree(scene, right, 0, 100, begin_frame, 30);
     begin_frame += 30;
     
-    int xl = (left->type == CTT_LEAF)
-        ? left->sym.txt->txt.center_x
-        : left->children.node_txt->txt.center_x;
-    int xr = (right->type == CTT_LEAF)
-        ? right->sym.txt->txt.center_x
-        : right->children.node_txt->txt.center_x;
+    // Both subtrees are still roots here, so their groups are in world space
+    int xl = left->group->grp.x;
+    int xr = right->group->grp.x;
+    int xc = (xl + xr) / 2;
+    
+    result.group = panim_scene_add_group(scene, NULL, xc, 100);
+    panim_object_set_parent(left->group,  result.group, true);
+    panim_object_set_parent(right->group, result.group, true);
     
     result.children.node_bg = panim_fade_in_image(
-        scene, circle, 1, (xl + xr) / 2, 100, begin_frame, 60);
+        scene, circle, 1, 0, 0, begin_frame, 60);
+    panim_object_set_parent(result.children.node_bg, result.group, false);
     
-    char * lbl = (char *) malloc(4);
+    char lbl[4];
     snprintf(lbl, 4, "%d", result.freq);
     result.children.node_txt = panim_fade_in_text(
         scene, lbl, font, (SDL_Color){ 0xFF, 0xFF, 0xFF, 0xFF }, 2,
-        (xl + xr) / 2, 100, PNM_TXT_ALIGN_CENTER, begin_frame, 60);
+        0, 0, PNM_TXT_ALIGN_CENTER, begin_frame, 60);
+    panim_object_set_parent(result.children.node_txt, result.group, false);
     begin_frame += 45;
         
     SDL_Color line_color = (SDL_Color){ 0xC8, 0xC8, 0xC8, 0xFF };
     result.children.linel = panim_draw_line(
-        scene, line_color, 0, (xl + xr) / 2, 100, xl, 200, begin_frame, 60);
+        scene, line_color, 0, 0, 0, xl - xc, 100, begin_frame, 60);
+    panim_line_set_style(result.children.linel, 4.0f, PNM_LINE_CAP_ROUND);
+    panim_object_set_parent(result.children.linel, result.group, false);
     result.children.liner = panim_draw_line(
-        scene, line_color, 0, (xl + xr) / 2, 100, xr, 200, begin_frame, 60);
+        scene, line_color, 0, 0, 0, xr - xc, 100, begin_frame, 60);
+    panim_line_set_style(result.children.liner, 4.0f, PNM_LINE_CAP_ROUND);
+    panim_object_set_parent(result.children.liner, result.group, false);
         
     return result;
 }
     
 static void
-load_content(SDL_Renderer * renderer) {
-    circle = IMG_LoadTexture(renderer, "circle.png");
-    font   = TTF_OpenFont("bin/Oswald-Bold.ttf", 36);
+load_content(PAnimEngine * pnm) {
+    circle = panim_engine_load_image(pnm, "circle.png");
+    font   = panim_engine_load_font(pnm, "bin/Oswald-Bold.ttf", 36);
 }
\ No newline at end of file
@@ -99,6 +99,7 @@ add_tree_labels(PAnimScene * scene, CodeTree * tree) {
     tree->children.lbl_l = panim_fade_in_text(
         scene, "0", font, (SDL_Color){ 0xFF, 0xFF, 0xFF, 0xFF },
         4, 0, 0, PNM_TXT_ALIGN_CENTER, timeline_cursor, 20);
+    panim_object_set_parent(tree->children.lbl_l, tree->group, false);
     panim_colocate(
         scene, tree->children.lbl_l,
         tree->children.linel,
@@ -108,6 +109,7 @@ add_tree_labels(PAnimScene * scene, CodeTree * tree) {
     tree->children.lbl_r = panim_fade_in_text(
         scene, "1", font, (SDL_Color){ 0xFF, 0xFF, 0xFF, 0xFF },
         4, 0, 0, PNM_TXT_ALIGN_CENTER, timeline_cursor, 20);
+    panim_object_set_parent(tree->children.lbl_r, tree->group, false);
     panim_colocate(
         scene, tree->children.lbl_r,
         tree->children.liner, 
@@ -119,12 +121,16 @@ add_tree_labels(PAnimScene * scene, CodeTree * tree) {
     timeline_cursor -= 30;
 }
 
+// The camera pans right by this much once the tree is complete,
+// making room for the table of code words
+static const int tree_pan_x = 250;
 static int code_word_table_y = 100;
 
 static void
 add_code_words(PAnimScene * scene, CodeTree * tree, int codeword, int codelen) {
     if (tree->type == CTT_LEAF) {
-        char * code = (char *) calloc(codelen + 4, 1);
+        char code[64] = {0};
+        assert(codelen + 4 <= 64);
         code[0] = tree->sym.symbol;
         code[1] = ':';
         code[2] = ' ';
@@ -137,7 +143,7 @@ add_code_words(PAnimScene * scene, CodeTree * tree, int codeword, int codelen) {
         }
         
         panim_fade_in_text(scene, code, font, (SDL_Color){ 0xFF, 0xFF, 0xFF, 0xFF },
-                           5, 900, code_word_table_y, PNM_TXT_ALIGN_LEFT, timeline_cursor, 60);
+                           5, 900 + tree_pan_x, code_word_table_y, PNM_TXT_ALIGN_LEFT, timeline_cursor, 60);
         code_word_table_y += 100;
         timeline_cursor += 30;
     } else {
@@ -161,28 +167,28 @@ add_code_words(PAnimScene * scene, CodeTree * tree, int codeword, int codelen) {
     }
 }
 
-int main(int argc, char *argv[]) {
-    // Initialize PAnim
-    PAnimScene scene = {0};
-    scene.length_in_frames = 0;
-    scene.screen_width  = 1280;
-    scene.screen_height =  720;
-    scene.bg_color = (SDL_Color){ 32, 32, 32, 0xFF };
-    
-    PAnimEngine pnm = panim_engine_begin_preview(&scene);
-    load_content(pnm.renderer);
-    
-    // Populate Scene
-    CodeTree * huff = build_huff_tree(&scene, "ABRACADABRA");
-    timeline_cursor = scene.length_in_frames + 30;
-    add_tree_labels(&scene, huff);
-    
-    timeline_cursor = scene.length_in_frames + 30;
-    move_tree(&scene, huff, -250, 0, timeline_cursor, 30);
+static void
+setup_scene(PAnimScene * scene) {
+    scene->screen_width  = 1280;
+    scene->screen_height =  720;
+    scene->bg_color = (SDL_Color){ 32, 32, 32, 0xFF };
+}
+
+static void
+build_scene(PAnimScene * scene) {
+    // Populate Scene, sealing each part so the preview can start showing it
+    CodeTree * huff = build_huff_tree(scene, "ABRACADABRA");
+    panim_scene_seal(scene, scene->length_in_frames);
+    timeline_cursor = scene->length_in_frames + 30;
+    add_tree_labels(scene, huff);
+    panim_scene_seal(scene, scene->length_in_frames);
     
-    timeline_cursor = scene.length_in_frames + 30;
-    add_code_words(&scene, huff, 0, 0);
+    timeline_cursor = scene->length_in_frames + 30;
+    panim_camera_pan(scene, tree_pan_x, 0, true, timeline_cursor, 30);
+    panim_scene_seal(scene, scene->length_in_frames);
     
-    // Hand off to PAnim
-    return panim_main(argc, argv, &pnm, &scene);
-}
\ No newline at end of file
+    timeline_cursor = scene->length_in_frames + 30;
+    add_code_words(scene, huff, 0, 0);
+}
+
+PANIM_SCENE(setup_scene, load_content, build_scene)
\ No newline at end of file